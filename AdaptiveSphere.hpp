@@ -0,0 +1,273 @@
+#ifndef ADAPTIVESPHERE_H
+#define ADAPTIVESPHERE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "graphics.hpp"
+#include "IcosphereTables.hpp"
+#include "MeshOptimizer.hpp"
+
+// View-dependent icosphere: each base face is refined on its own until its
+// projected error drops under a pixel threshold or the triangle budget runs
+// out, finest-error first. Neighbouring triangles are kept within one level of
+// each other and then closed with 2/3/4-way splits along their subdivided
+// edges, so there are no T-junctions and no cracks.
+
+struct AdaptiveSphereParams {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 cameraPosition;
+    float fovDegrees;          // Vertical field of view, i.e. Camera::Zoom
+    float viewportHeight;      // In pixels
+    float pixelError;          // Refine while a triangle's sag projects to more than this
+    size_t triangleBudget;     // Drawn triangles, crack closing included; at least the 20 base faces
+    int maxDepth;
+    bool cullBeyondHorizon;    // Drop triangles the camera cannot see over the horizon
+
+    AdaptiveSphereParams()
+        : center(0.0f), radius(1.0f), cameraPosition(0.0f, 0.0f, 3.0f), fovDegrees(45.0f), viewportHeight(600.0f),
+          pixelError(1.0f), triangleBudget(100000), maxDepth(16), cullBeyondHorizon(true) {}
+};
+
+class AdaptiveIcosphereBuilder {
+public:
+    explicit AdaptiveIcosphereBuilder(const AdaptiveSphereParams& params) : params(params), liveTriangles(0) {
+        cameraLocal = (params.cameraPosition - params.center) / params.radius;
+        cameraDistance = glm::length(cameraLocal);
+        horizonAngle = cameraDistance > 1.0f ? std::acos(1.0f / cameraDistance) : 3.14159265f;
+        pixelsPerRadian = params.viewportHeight / (2.0f * std::tan(glm::radians(params.fovDegrees) / 2.0f));
+    }
+
+    IndexedMesh build(NormalMode normalMode) {
+        // Balancing and crack closing add triangles after refine() has stopped. A pass that ends
+        // over budget is redone with refine() stopped short by the overshoot; more refinement never
+        // yields fewer triangles, so this settles on a mesh that fits
+        IndexedMesh mesh;
+        size_t refineBudget = params.triangleBudget;
+        for (;;) {
+            MeshView base = icosphereTableView(0);
+            vertices.assign(base.vertices, base.vertices + base.vertexCount);
+            triangles.clear();
+            midpoints.clear();
+            liveTriangles = 0;
+            for (size_t i = 0; i < base.indexCount; i += 3)
+                addTriangle(base.indices[i], base.indices[i + 1], base.indices[i + 2], 0);
+
+            size_t baseTriangles = liveTriangles;
+            refine(refineBudget);
+            balance();
+
+            mesh.indices.clear();
+            closeCracks(mesh.indices);
+            size_t triangleCount = mesh.indices.size() / 3;
+            if (triangleCount <= params.triangleBudget || liveTriangles == baseTriangles) {
+                break;
+            }
+            refineBudget -= std::min(refineBudget, triangleCount - params.triangleBudget);
+        }
+        assert(mesh.indices.size() / 3 <= std::max(params.triangleBudget, size_t(20)));
+
+        mesh.vertices.swap(vertices);
+        // Vertices of culled triangles go unreferenced; this drops them and orders the rest for fetch
+        optimizeVertexFetch(mesh);
+
+        if (normalMode == NORMALS_EMIT) {
+            mesh.normals = normalsFromPositions(mesh.vertices);
+        }
+
+        return mesh;
+    }
+
+private:
+    struct Triangle {
+        unsigned int v[3];
+        int depth;
+        float error; // Projected sag in pixels
+        bool split;
+        bool culled;
+    };
+
+    AdaptiveSphereParams params;
+    glm::vec3 cameraLocal; // Camera in unit-sphere space
+    float cameraDistance;
+    float horizonAngle;
+    float pixelsPerRadian;
+
+    std::vector<Vec3> vertices;
+    std::vector<Triangle> triangles;
+    std::unordered_map<uint64_t, unsigned int> midpoints;
+    size_t liveTriangles; // Leaves that will be drawn
+
+    static uint64_t edgeKey(unsigned int a, unsigned int b) {
+        return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+    glm::vec3 position(unsigned int index) const {
+        const Vec3& v = vertices[index];
+        return glm::vec3(v.x, v.y, v.z);
+    }
+
+    void addTriangle(unsigned int a, unsigned int b, unsigned int c, int depth) {
+        Triangle triangle = { { a, b, c }, depth, 0.0f, false, false };
+
+        glm::vec3 pa = position(a), pb = position(b), pc = position(c);
+        glm::vec3 centroid = (pa + pb + pc) / 3.0f;
+        glm::vec3 axis = glm::normalize(centroid);
+        float spread = std::acos(std::min({ glm::dot(axis, pa), glm::dot(axis, pb), glm::dot(axis, pc) }));
+
+        // The patch is hidden when its bounding cone lies entirely past the horizon circle
+        if (params.cullBeyondHorizon && cameraDistance > 1.0f) {
+            float cameraAngle = std::acos(glm::clamp(glm::dot(axis, cameraLocal / cameraDistance), -1.0f, 1.0f));
+            triangle.culled = cameraAngle - spread > horizonAngle;
+        }
+
+        if (!triangle.culled) {
+            float sag = (1.0f - glm::length(centroid)) * params.radius;
+            float chord = glm::max(glm::length(pa - axis), glm::max(glm::length(pb - axis), glm::length(pc - axis)));
+            float distance = glm::length(axis - cameraLocal) - chord;
+            distance = std::max(distance * params.radius, 1e-6f * params.radius);
+            triangle.error = sag * pixelsPerRadian / distance;
+            liveTriangles++;
+        }
+
+        triangles.push_back(triangle);
+    }
+
+    unsigned int midpoint(unsigned int a, unsigned int b) {
+        auto inserted = midpoints.emplace(edgeKey(a, b), unsigned(vertices.size()));
+        if (inserted.second)
+            vertices.push_back((vertices[a] + vertices[b]).normalize());
+        return inserted.first->second;
+    }
+
+    int findMidpoint(unsigned int a, unsigned int b) const {
+        auto it = midpoints.find(edgeKey(a, b));
+        return it != midpoints.end() ? int(it->second) : -1;
+    }
+
+    // Same child order and winding as createIndexedIcosphere()
+    void split(size_t index) {
+        Triangle& parent = triangles[index];
+        parent.split = true;
+        if (!parent.culled)
+            liveTriangles--;
+
+        unsigned int v1 = parent.v[0], v2 = parent.v[1], v3 = parent.v[2];
+        int depth = parent.depth + 1;
+        unsigned int mid1 = midpoint(v1, v2);
+        unsigned int mid2 = midpoint(v2, v3);
+        unsigned int mid3 = midpoint(v3, v1);
+
+        // `parent` may dangle from here on as triangles grows
+        addTriangle(v1, mid1, mid3, depth);
+        addTriangle(v2, mid2, mid1, depth);
+        addTriangle(v3, mid3, mid2, depth);
+        addTriangle(mid1, mid2, mid3, depth);
+    }
+
+    // Splits the worst triangle until all are under the pixel error or the leaves reach `budget`
+    void refine(size_t budget) {
+        std::priority_queue<std::pair<float, size_t>> queue;
+        for (size_t i = 0; i < triangles.size(); i++) {
+            if (!triangles[i].culled)
+                queue.push(std::make_pair(triangles[i].error, i));
+        }
+
+        while (!queue.empty()) {
+            std::pair<float, size_t> top = queue.top();
+            if (top.first <= params.pixelError || liveTriangles + 3 > budget) {
+                break;
+            }
+            queue.pop();
+
+            if (triangles[top.second].depth >= params.maxDepth) {
+                continue;
+            }
+
+            size_t firstChild = triangles.size();
+            split(top.second);
+            for (size_t i = firstChild; i < triangles.size(); i++) {
+                if (!triangles[i].culled)
+                    queue.push(std::make_pair(triangles[i].error, i));
+            }
+        }
+    }
+
+    // An edge whose midpoint was itself split borders a triangle two or more
+    // levels finer; splitting until none are left keeps neighbours within one level
+    bool needsBalance(const Triangle& triangle) const {
+        for (int e = 0; e < 3; e++) {
+            unsigned int a = triangle.v[e], b = triangle.v[(e + 1) % 3];
+            int mid = findMidpoint(a, b);
+            if (mid >= 0 && (findMidpoint(a, mid) >= 0 || findMidpoint(mid, b) >= 0))
+                return true;
+        }
+        return false;
+    }
+
+    void balance() {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            // Children appended during the pass are visited in the same pass
+            for (size_t i = 0; i < triangles.size(); i++) {
+                if (!triangles[i].split && !triangles[i].culled && needsBalance(triangles[i])) {
+                    split(i);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    void closeCracks(std::vector<unsigned int>& indices) const {
+        indices.reserve(liveTriangles * 3 * 2);
+
+        for (const Triangle& triangle : triangles) {
+            if (triangle.split || triangle.culled) {
+                continue;
+            }
+
+            const unsigned int* v = triangle.v;
+            int mid[3];
+            int splitEdges = 0;
+            for (int e = 0; e < 3; e++) {
+                mid[e] = findMidpoint(v[e], v[(e + 1) % 3]);
+                splitEdges += mid[e] >= 0;
+            }
+
+            if (splitEdges == 0) {
+                indices.insert(indices.end(), { v[0], v[1], v[2] });
+            } else if (splitEdges == 1) {
+                int e = mid[0] >= 0 ? 0 : mid[1] >= 0 ? 1 : 2;
+                unsigned int m = mid[e];
+                unsigned int a = v[e], b = v[(e + 1) % 3], c = v[(e + 2) % 3];
+                indices.insert(indices.end(), { a, m, c, m, b, c });
+            } else if (splitEdges == 2) {
+                // Rotate so the unsplit edge is c-a
+                int e = mid[0] < 0 ? 1 : mid[1] < 0 ? 2 : 0;
+                unsigned int a = v[e], b = v[(e + 1) % 3], c = v[(e + 2) % 3];
+                unsigned int mab = mid[e], mbc = mid[(e + 1) % 3];
+                indices.insert(indices.end(), { mab, b, mbc, a, mab, mbc, a, mbc, c });
+            } else {
+                unsigned int m1 = mid[0], m2 = mid[1], m3 = mid[2];
+                indices.insert(indices.end(), { v[0], m1, m3, v[1], m2, m1, v[2], m3, m2, m1, m2, m3 });
+            }
+        }
+    }
+};
+
+// Unit-sphere mesh refined for the given view; draw it with params.center and params.radius in the model matrix
+inline IndexedMesh createAdaptiveIcosphere(const AdaptiveSphereParams& params, NormalMode normalMode = NORMALS_OMIT) {
+    AdaptiveIcosphereBuilder builder(params);
+    return builder.build(normalMode);
+}
+
+#endif // ADAPTIVESPHERE_H
@@ -0,0 +1,452 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+#include "Frustum.hpp"
+
+struct BvhRayHit {
+    uint32_t object; // SphereBVH::NONE when nothing was hit
+    float distance;  // Along the ray, 0 when it starts inside the sphere
+};
+
+// Bounding volume hierarchy over bounding spheres, with axis-aligned boxes at
+// the nodes. Built top-down with a binned surface area heuristic; objects that
+// move are updated in place and refit() re-grows only the boxes above them, so
+// the tree stays valid but slowly loosens; rebuild when queries get slower.
+//
+// Object ids are indices into the sphere array given to build().
+class SphereBVH {
+public:
+    static constexpr uint32_t NONE = 0xffffffffu;
+    static constexpr uint32_t MAX_LEAF_SIZE = 4;
+
+    SphereBVH() : anyDirty(false) {}
+
+    // Spheres as centre in xyz, radius in w
+    void build(const std::vector<glm::vec4>& spheres) {
+        this->spheres = spheres;
+        size_t count = spheres.size();
+        primitives.resize(count);
+        for (size_t i = 0; i < count; i++)
+            primitives[i] = uint32_t(i);
+
+        nodes.clear();
+        parents.clear();
+        leafOf.assign(count, NONE);
+        nodes.reserve(count > 0 ? 2 * count / MAX_LEAF_SIZE + 1 : 1);
+        if (count == 0) {
+            anyDirty = false;
+            return;
+        }
+
+        std::vector<glm::vec3> centers(count);
+        for (size_t i = 0; i < count; i++)
+            centers[i] = glm::vec3(spheres[i]);
+
+        nodes.push_back(Node());
+        parents.push_back(NONE);
+        std::vector<uint32_t> stack(1, 0);
+        nodes[0].first = 0;
+        nodes[0].count = uint32_t(count);
+
+        // Children are always appended after their parent, which refit() relies on
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            stack.pop_back();
+            uint32_t first = nodes[index].first;
+            uint32_t nodeCount = nodes[index].count;
+            computeBounds(nodes[index]);
+            nodes[index].child = 0;
+
+            uint32_t split = nodeCount > MAX_LEAF_SIZE ? partition(first, nodeCount, centers, nodes[index]) : 0;
+            if (split == 0) {
+                for (uint32_t i = first; i < first + nodeCount; i++)
+                    leafOf[primitives[i]] = index;
+                continue;
+            }
+
+            uint32_t left = uint32_t(nodes.size());
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            parents.push_back(index);
+            parents.push_back(index);
+            nodes[index].child = left;
+            nodes[left].first = first;
+            nodes[left].count = split;
+            nodes[left + 1].first = first + split;
+            nodes[left + 1].count = nodeCount - split;
+            stack.push_back(left + 1);
+            stack.push_back(left);
+        }
+
+        dirty.assign(nodes.size(), 0);
+        anyDirty = false;
+    }
+
+    // Moves or resizes one object; the boxes above it are fixed by the next refit()
+    void update(uint32_t object, const glm::vec3& center, float radius) {
+        spheres[object] = glm::vec4(center, radius);
+        for (uint32_t node = leafOf[object]; node != NONE && !dirty[node]; node = parents[node])
+            dirty[node] = 1;
+        anyDirty = true;
+    }
+
+    void refit() {
+        if (!anyDirty) {
+            return;
+        }
+
+        for (size_t i = nodes.size(); i-- > 0;) {
+            if (!dirty[i]) {
+                continue;
+            }
+            Node& node = nodes[i];
+            if (node.child == 0) {
+                computeBounds(node);
+            } else {
+                const Node& left = nodes[node.child];
+                const Node& right = nodes[node.child + 1];
+                node.min = glm::min(left.min, right.min);
+                node.max = glm::max(left.max, right.max);
+            }
+            dirty[i] = 0;
+        }
+        anyDirty = false;
+    }
+
+    // Appends every object whose sphere touches the frustum
+    void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& result) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        // Each entry carries the planes its box still straddles; boxes inside all of them are taken whole
+        const int allPlanes = (1 << Frustum::PLANE_COUNT) - 1;
+        std::vector<std::pair<uint32_t, int>> stack;
+        stack.push_back(std::make_pair(0u, allPlanes));
+
+        while (!stack.empty()) {
+            uint32_t index = stack.back().first;
+            int planes = stack.back().second;
+            stack.pop_back();
+            const Node& node = nodes[index];
+
+            bool outside = false;
+            for (int p = 0; p < Frustum::PLANE_COUNT && !outside; p++) {
+                if (!(planes & (1 << p))) {
+                    continue;
+                }
+                const glm::vec4& plane = frustum.getPlane(p);
+                glm::vec3 normal(plane);
+                glm::vec3 farthest(normal.x >= 0.0f ? node.max.x : node.min.x, normal.y >= 0.0f ? node.max.y : node.min.y, normal.z >= 0.0f ? node.max.z : node.min.z);
+                glm::vec3 nearest(normal.x >= 0.0f ? node.min.x : node.max.x, normal.y >= 0.0f ? node.min.y : node.max.y, normal.z >= 0.0f ? node.min.z : node.max.z);
+                if (glm::dot(normal, farthest) + plane.w < 0.0f)
+                    outside = true;
+                else if (glm::dot(normal, nearest) + plane.w >= 0.0f)
+                    planes &= ~(1 << p);
+            }
+            if (outside) {
+                continue;
+            }
+
+            if (planes == 0) {
+                result.insert(result.end(), primitives.begin() + node.first, primitives.begin() + node.first + node.count);
+            } else if (node.child == 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    const glm::vec4& sphere = spheres[primitives[i]];
+                    if (frustum.containsSphere(glm::vec3(sphere), sphere.w))
+                        result.push_back(primitives[i]);
+                }
+            } else {
+                stack.push_back(std::make_pair(node.child, planes));
+                stack.push_back(std::make_pair(node.child + 1, planes));
+            }
+        }
+    }
+
+    // Nearest sphere along a ray with a unit-length direction, closer than maxDistance
+    BvhRayHit raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance = std::numeric_limits<float>::max()) const {
+        BvhRayHit hit = { NONE, maxDistance };
+        if (nodes.empty()) {
+            return hit;
+        }
+
+        glm::vec3 inverseDirection = 1.0f / direction;
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (rayBoxEntry(node, origin, inverseDirection) > hit.distance) {
+                continue;
+            }
+
+            if (node.child == 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    float distance = raySphere(origin, direction, spheres[primitives[i]]);
+                    if (distance < hit.distance) {
+                        hit.distance = distance;
+                        hit.object = primitives[i];
+                    }
+                }
+                continue;
+            }
+
+            // Push the farther child first so the nearer one is searched first and shortens the ray for the other
+            float leftEntry = rayBoxEntry(nodes[node.child], origin, inverseDirection);
+            float rightEntry = rayBoxEntry(nodes[node.child + 1], origin, inverseDirection);
+            uint32_t nearChild = leftEntry <= rightEntry ? node.child : node.child + 1;
+            float farEntry = std::max(leftEntry, rightEntry);
+            if (farEntry <= hit.distance)
+                stack.push_back(nearChild == node.child ? node.child + 1 : node.child);
+            if (std::min(leftEntry, rightEntry) <= hit.distance)
+                stack.push_back(nearChild);
+        }
+
+        return hit;
+    }
+
+    // Appends every object whose sphere overlaps the query sphere
+    void querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& result) const {
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+
+            glm::vec3 offset = center - glm::clamp(center, node.min, node.max);
+            if (glm::dot(offset, offset) > radius * radius) {
+                continue;
+            }
+
+            if (node.child == 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                    const glm::vec4& sphere = spheres[primitives[i]];
+                    glm::vec3 toCenter = glm::vec3(sphere) - center;
+                    float reach = radius + sphere.w;
+                    if (glm::dot(toCenter, toCenter) <= reach * reach)
+                        result.push_back(primitives[i]);
+                }
+            } else {
+                stack.push_back(node.child);
+                stack.push_back(node.child + 1);
+            }
+        }
+    }
+
+    // The topmost nodes holding at most maxObjects objects each; together they cover every object once.
+    // Their ids stay valid across update() and refit(), until the next build()
+    void collectClusters(uint32_t maxObjects, std::vector<uint32_t>& clusters) const {
+        clusters.clear();
+        if (nodes.empty()) {
+            return;
+        }
+
+        std::vector<uint32_t> stack(1, 0);
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[index];
+            if (node.count <= maxObjects || node.child == 0) {
+                clusters.push_back(index);
+            } else {
+                stack.push_back(node.child + 1);
+                stack.push_back(node.child);
+            }
+        }
+    }
+
+    const glm::vec3& getNodeMin(uint32_t node) const {
+        return nodes[node].min;
+    }
+
+    const glm::vec3& getNodeMax(uint32_t node) const {
+        return nodes[node].max;
+    }
+
+    // Objects in the node's subtree are getNodeObjects(node)[0, getNodeObjectCount(node))
+    const uint32_t* getNodeObjects(uint32_t node) const {
+        return primitives.data() + nodes[node].first;
+    }
+
+    uint32_t getNodeObjectCount(uint32_t node) const {
+        return nodes[node].count;
+    }
+
+    const glm::vec4& getSphere(uint32_t object) const {
+        return spheres[object];
+    }
+
+    size_t size() const {
+        return spheres.size();
+    }
+
+    size_t getNodeCount() const {
+        return nodes.size();
+    }
+
+    // Expected cost of a random query relative to testing every object; grows as refits loosen the tree
+    float getSahCost() const {
+        if (nodes.empty()) {
+            return 0.0f;
+        }
+        float rootArea = surfaceArea(nodes[0].min, nodes[0].max);
+        float cost = 0.0f;
+        for (const Node& node : nodes) {
+            float area = surfaceArea(node.min, node.max) / rootArea;
+            cost += node.child == 0 ? area * node.count : area;
+        }
+        return cost / spheres.size();
+    }
+
+private:
+    struct Node {
+        glm::vec3 min;
+        uint32_t first; // Objects primitives[first, first + count) are in this subtree
+        glm::vec3 max;
+        uint32_t count;
+        uint32_t child; // Left child, right is child + 1; 0 for leaves (the root is never a child)
+    };
+
+    static constexpr int BIN_COUNT = 16;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> primitives; // Object ids, grouped so every subtree is one contiguous range
+    std::vector<glm::vec4> spheres;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> leafOf;
+    std::vector<uint8_t> dirty;
+    bool anyDirty;
+
+    static float surfaceArea(const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    void computeBounds(Node& node) const {
+        node.min = glm::vec3(std::numeric_limits<float>::max());
+        node.max = glm::vec3(-std::numeric_limits<float>::max());
+        for (uint32_t i = node.first; i < node.first + node.count; i++) {
+            const glm::vec4& sphere = spheres[primitives[i]];
+            node.min = glm::min(node.min, glm::vec3(sphere) - sphere.w);
+            node.max = glm::max(node.max, glm::vec3(sphere) + sphere.w);
+        }
+    }
+
+    // Splits the node's range at the cheapest of BIN_COUNT centroid planes per axis and returns the
+    // size of the left part, or 0 when splitting would not beat a leaf
+    uint32_t partition(uint32_t first, uint32_t count, const std::vector<glm::vec3>& centers, const Node& node) {
+        glm::vec3 centerMin(std::numeric_limits<float>::max()), centerMax(-std::numeric_limits<float>::max());
+        for (uint32_t i = first; i < first + count; i++) {
+            centerMin = glm::min(centerMin, centers[primitives[i]]);
+            centerMax = glm::max(centerMax, centers[primitives[i]]);
+        }
+
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestBin = 0;
+
+        for (int axis = 0; axis < 3; axis++) {
+            float extent = centerMax[axis] - centerMin[axis];
+            if (extent <= 0.0f) {
+                continue;
+            }
+            float scale = BIN_COUNT / extent;
+
+            uint32_t binCount[BIN_COUNT] = {};
+            glm::vec3 binMin[BIN_COUNT], binMax[BIN_COUNT];
+            for (int b = 0; b < BIN_COUNT; b++) {
+                binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+                binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+            }
+            for (uint32_t i = first; i < first + count; i++) {
+                const glm::vec4& sphere = spheres[primitives[i]];
+                int b = std::min(int((centers[primitives[i]][axis] - centerMin[axis]) * scale), BIN_COUNT - 1);
+                binCount[b]++;
+                binMin[b] = glm::min(binMin[b], glm::vec3(sphere) - sphere.w);
+                binMax[b] = glm::max(binMax[b], glm::vec3(sphere) + sphere.w);
+            }
+
+            // Sweep from the right to get the area and count of every right-hand side, then from the left
+            float rightCost[BIN_COUNT];
+            glm::vec3 sweepMin(std::numeric_limits<float>::max()), sweepMax(-std::numeric_limits<float>::max());
+            uint32_t sweepCount = 0;
+            for (int b = BIN_COUNT - 1; b > 0; b--) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                rightCost[b] = sweepCount > 0 ? surfaceArea(sweepMin, sweepMax) * sweepCount : 0.0f;
+            }
+            sweepMin = glm::vec3(std::numeric_limits<float>::max());
+            sweepMax = glm::vec3(-std::numeric_limits<float>::max());
+            sweepCount = 0;
+            for (int b = 0; b < BIN_COUNT - 1; b++) {
+                sweepMin = glm::min(sweepMin, binMin[b]);
+                sweepMax = glm::max(sweepMax, binMax[b]);
+                sweepCount += binCount[b];
+                if (sweepCount == 0 || sweepCount == count) {
+                    continue;
+                }
+                float cost = surfaceArea(sweepMin, sweepMax) * sweepCount + rightCost[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        // With a traversal step costing as much as one sphere test, a split pays off when it halves the expected tests
+        float leafCost = surfaceArea(node.min, node.max) * count;
+        if (bestAxis < 0 || (bestCost + surfaceArea(node.min, node.max) >= leafCost && count <= 4 * MAX_LEAF_SIZE)) {
+            return 0;
+        }
+
+        float scale = BIN_COUNT / (centerMax[bestAxis] - centerMin[bestAxis]);
+        uint32_t* middle = std::partition(primitives.data() + first, primitives.data() + first + count, [&](uint32_t object) {
+            return std::min(int((centers[object][bestAxis] - centerMin[bestAxis]) * scale), BIN_COUNT - 1) <= bestBin;
+        });
+        return uint32_t(middle - (primitives.data() + first));
+    }
+
+    // Distance at which the ray enters the box, or infinity if it misses
+    static float rayBoxEntry(const Node& node, const glm::vec3& origin, const glm::vec3& inverseDirection) {
+        glm::vec3 t0 = (node.min - origin) * inverseDirection;
+        glm::vec3 t1 = (node.max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+        return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+    }
+
+    static float raySphere(const glm::vec3& origin, const glm::vec3& direction, const glm::vec4& sphere) {
+        glm::vec3 toOrigin = origin - glm::vec3(sphere);
+        float along = glm::dot(toOrigin, direction);
+        float c = glm::dot(toOrigin, toOrigin) - sphere.w * sphere.w;
+        if (c <= 0.0f) {
+            return 0.0f; // Inside
+        }
+        if (along > 0.0f) {
+            return std::numeric_limits<float>::infinity(); // In front of the origin, pointing away
+        }
+        // Closest approach form, as in the impostor shader, to stay precise for small far spheres
+        glm::vec3 closest = toOrigin - along * direction;
+        float discriminant = sphere.w * sphere.w - glm::dot(closest, closest);
+        if (discriminant < 0.0f) {
+            return std::numeric_limits<float>::infinity();
+        }
+        return -along - std::sqrt(discriminant);
+    }
+};
+
+#endif // BVH_H
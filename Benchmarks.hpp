@@ -0,0 +1,364 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+#include "graphics.hpp"
+#include "ThreadPool.hpp"
+#include "SphereGenerators.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+
+// Offline benchmarks, run from the command line before any window is created
+
+// Closest point on triangle abc to p (Ericson, Real-Time Collision Detection 5.1.5)
+inline glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    float denom = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+struct SphereMeshStats {
+    size_t triangles;
+    size_t vertices;
+    float maxError;  // Largest gap between the flat triangles and the unit sphere, in radii
+    float areaRatio; // Largest over smallest triangle area; 1 means perfectly even tessellation
+    double milliseconds;
+};
+
+inline SphereMeshStats measureSphere(SphereTopology topology, int detail) {
+    auto start = std::chrono::steady_clock::now();
+    IndexedMesh mesh = createSphere(topology, detail);
+    auto end = std::chrono::steady_clock::now();
+
+    SphereMeshStats stats;
+    stats.triangles = mesh.indices.size() / 3;
+    stats.vertices = mesh.vertices.size();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    stats.maxError = 0.0f;
+
+    float minArea = 1e30f, maxArea = 0.0f;
+    std::vector<glm::vec3> positions = normalsFromPositions(mesh.vertices); // Unit sphere: the same vectors
+    for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+        const glm::vec3& a = positions[mesh.indices[i]];
+        const glm::vec3& b = positions[mesh.indices[i + 1]];
+        const glm::vec3& c = positions[mesh.indices[i + 2]];
+
+        glm::vec3 closest = closestPointOnTriangle(glm::vec3(0.0f), a, b, c);
+        stats.maxError = std::max(stats.maxError, 1.0f - glm::length(closest));
+
+        float area = 0.5f * glm::length(glm::cross(b - a, c - a));
+        minArea = std::min(minArea, area);
+        maxArea = std::max(maxArea, area);
+    }
+    stats.areaRatio = minArea > 0.0f ? maxArea / minArea : 0.0f;
+
+    return stats;
+}
+
+inline double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Solid angle of the spherical triangle abc (Van Oosterom and Strackee)
+inline double sphericalTriangleArea(const glm::dvec3& a, const glm::dvec3& b, const glm::dvec3& c) {
+    double numerator = std::fabs(glm::dot(a, glm::cross(b, c)));
+    double denominator = 1.0 + glm::dot(a, b) + glm::dot(b, c) + glm::dot(c, a);
+    return 2.0 * std::atan2(numerator, denominator);
+}
+
+// Largest over smallest solid angle of the cells of one (segments x segments) cube
+// face. Each cell is measured as samples^2 spherical quads, so its curved edges are
+// followed more closely as samples grows.
+inline double cubeFaceCellAreaRatio(CubeSphereMapping mapping, int segments, int samples) {
+    auto onSphere = [mapping](double u, double v) {
+        Vec3 p = cubeFaceToSphere(float(u), float(v), mapping);
+        return glm::normalize(glm::dvec3(p.x, p.y, p.z));
+    };
+
+    double minArea = std::numeric_limits<double>::max(), maxArea = 0.0;
+    double step = 2.0 / (double(segments) * samples);
+    for (int i = 0; i < segments; i++) {
+        for (int j = 0; j < segments; j++) {
+            double area = 0.0;
+            for (int a = 0; a < samples; a++) {
+                for (int b = 0; b < samples; b++) {
+                    double u0 = -1.0 + (i * samples + a) * step, v0 = -1.0 + (j * samples + b) * step;
+                    glm::dvec3 p00 = onSphere(u0, v0), p10 = onSphere(u0 + step, v0);
+                    glm::dvec3 p11 = onSphere(u0 + step, v0 + step), p01 = onSphere(u0, v0 + step);
+                    area += sphericalTriangleArea(p00, p10, p11) + sphericalTriangleArea(p00, p11, p01);
+                }
+            }
+            minArea = std::min(minArea, area);
+            maxArea = std::max(maxArea, area);
+        }
+    }
+    return maxArea / minArea;
+}
+
+// Triangles spent against geometric error for each topology. Error is also
+// given in pixels for a sphere 1000 px across, which is what a viewer sees.
+inline void runSphereBenchmark() {
+    const SphereTopology topologies[] = {
+        SPHERE_TOPOLOGY_ICOSPHERE, SPHERE_TOPOLOGY_CUBE, SPHERE_TOPOLOGY_CUBE_EQUAL_AREA, SPHERE_TOPOLOGY_UV
+    };
+    const float pixelRadius = 500.0f;
+
+    std::printf("%-18s %7s %10s %10s %12s %10s %13s %10s\n", "topology", "detail", "triangles", "vertices", "max error", "error px", "area max/min", "ms");
+    for (SphereTopology topology : topologies) {
+        // Roughly matched triangle counts: icosphere levels 1-7, then similar budgets for the others
+        for (int step = 0; step < 7; step++) {
+            int detail = topology == SPHERE_TOPOLOGY_ICOSPHERE ? step + 1
+                       : topology == SPHERE_TOPOLOGY_UV ? 4 << step
+                       : 2 << step;
+            SphereMeshStats stats = measureSphere(topology, detail);
+            std::printf("%-18s %7d %10zu %10zu %12.3e %10.3f %13.2f %10.2f\n", sphereTopologyName(topology), detail,
+                        stats.triangles, stats.vertices, stats.maxError, stats.maxError * pixelRadius, stats.areaRatio, stats.milliseconds);
+        }
+    }
+
+    // Cheapest mesh of each topology that stays under a visual error budget
+    const float pixelBudgets[] = { 1.0f, 0.5f, 0.1f };
+    std::printf("\nTriangles needed for a sphere %.0f px across\n", 2.0f * pixelRadius);
+    std::printf("%-18s", "topology");
+    for (float budget : pixelBudgets)
+        std::printf(" %10.1f px", budget);
+    std::printf("\n");
+
+    for (SphereTopology topology : topologies) {
+        std::printf("%-18s", sphereTopologyName(topology));
+        for (float budget : pixelBudgets) {
+            size_t triangles = 0;
+            // Icosphere levels are coarse steps; the other topologies take any resolution
+            for (int detail = 1; detail <= (topology == SPHERE_TOPOLOGY_ICOSPHERE ? 9 : 2048); detail++) {
+                SphereMeshStats stats = measureSphere(topology, detail);
+                if (stats.maxError * pixelRadius <= budget) {
+                    triangles = stats.triangles;
+                    break;
+                }
+                // Error shrinks with the square of the resolution; jump close to the answer
+                if (topology != SPHERE_TOPOLOGY_ICOSPHERE) {
+                    float scale = std::sqrt(stats.maxError * pixelRadius / budget);
+                    detail = std::max(detail, int(detail * scale * 0.95f) - 1);
+                }
+            }
+            std::printf(" %13zu", triangles);
+        }
+        std::printf("\n");
+    }
+
+    // The pool must reproduce the serial triangle soup exactly, only faster
+    ThreadPool pool;
+    std::printf("\nNon-indexed icosphere on %u threads\n", pool.size());
+    std::printf("%7s %10s %12s %12s %10s\n", "detail", "triangles", "serial ms", "parallel ms", "identical");
+    for (int level = 4; level <= 8; level++) {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<Vec3> serial = createIcosphere(level);
+        double serialMs = millisecondsSince(start);
+        start = std::chrono::steady_clock::now();
+        std::vector<Vec3> parallel = createIcosphereParallel(level, pool);
+        double parallelMs = millisecondsSince(start);
+
+        bool identical = serial.size() == parallel.size() &&
+                         std::memcmp(serial.data(), parallel.data(), serial.size() * sizeof(Vec3)) == 0;
+        assert(identical);
+        std::printf("%7d %10zu %12.2f %12.2f %10s\n", level, serial.size() / 3, serialMs, parallelMs, identical ? "yes" : "NO");
+    }
+
+    // The equal-area mapping should give every cell the same solid angle: the ratio
+    // has to approach 1 as the cells' curved edges are sampled more finely
+    const int cellSamples[] = { 1, 4, 16 };
+    std::printf("\nCube face cell solid angle, max/min, by samples per cell edge\n");
+    std::printf("%-18s %7s", "mapping", "detail");
+    for (int samples : cellSamples)
+        std::printf(" %10d", samples);
+    std::printf("\n");
+    const CubeSphereMapping mappings[] = { CUBE_SPHERE_NORMALIZED, CUBE_SPHERE_EQUAL_AREA };
+    for (CubeSphereMapping mapping : mappings) {
+        for (int segments : { 8, 32, 128 }) {
+            std::printf("%-18s %7d", mapping == CUBE_SPHERE_EQUAL_AREA ? "equal-area" : "normalized", segments);
+            double ratio = 0.0;
+            for (int samples : cellSamples) {
+                ratio = cubeFaceCellAreaRatio(mapping, segments, samples);
+                std::printf(" %10.5f", ratio);
+            }
+            // Float positions leave a floor of a few 1e-4
+            if (mapping == CUBE_SPHERE_EQUAL_AREA && ratio > 1.001)
+                std::printf("  NOT EQUAL-AREA");
+            std::printf("\n");
+        }
+    }
+}
+
+// SphereBVH against testing every sphere, at constant density so the visible
+// fraction stays the same as the scene grows. Every query's result is checked
+// against the brute-force answer.
+inline void runBvhBenchmark() {
+    const size_t sceneSizes[] = { 10000, 100000, 1000000 };
+    const int frustumQueries = 20;
+    const int pointQueries = 200;
+
+    std::printf("%9s %9s %9s | %29s | %21s | %21s\n", "spheres", "build ms", "refit ms", "frustum ms: bvh / simd / scalar",
+                "ray us: bvh / brute", "near us: bvh / brute");
+
+    for (size_t count : sceneSizes) {
+        // 100k spheres fill a 100-unit cube, like the sphere field
+        float extent = 50.0f * std::cbrt(count / 100000.0f);
+        std::mt19937 random(1);
+        std::uniform_real_distribution<float> coordinate(-extent, extent);
+        std::uniform_real_distribution<float> radius(0.05f, 0.3f);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+        std::vector<glm::vec4> spheres(count);
+        SphereBounds bounds;
+        for (glm::vec4& sphere : spheres) {
+            sphere = glm::vec4(coordinate(random), coordinate(random), coordinate(random), radius(random));
+            bounds.push_back(glm::vec3(sphere), sphere.w);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        SphereBVH bvh;
+        bvh.build(spheres);
+        double buildMs = millisecondsSince(start);
+
+        // Nudge a tenth of the spheres, as a frame of motion would
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i += 10) {
+            glm::vec3 center = glm::vec3(spheres[i]) + 0.1f * glm::vec3(unit(random), unit(random), unit(random));
+            spheres[i] = glm::vec4(center, spheres[i].w);
+            bvh.update(uint32_t(i), center, spheres[i].w);
+            bounds.x[i] = center.x;
+            bounds.y[i] = center.y;
+            bounds.z[i] = center.z;
+        }
+        bvh.refit();
+        double refitMs = millisecondsSince(start);
+
+        // Cameras inside the volume looking in random directions, same projection as the viewer
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+        std::vector<Frustum> frustums;
+        for (int q = 0; q < frustumQueries; q++) {
+            glm::vec3 eye(coordinate(random), coordinate(random), coordinate(random));
+            glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)));
+            frustums.push_back(Frustum(projection * glm::lookAt(eye, eye + direction, glm::vec3(0.0f, 1.0f, 0.0f))));
+        }
+
+        std::vector<uint32_t> found, expected;
+        size_t mismatches = 0;
+        double bvhFrustumMs = 0.0, simdFrustumMs = 0.0, scalarFrustumMs = 0.0;
+        for (const Frustum& frustum : frustums) {
+            found.clear();
+            start = std::chrono::steady_clock::now();
+            bvh.queryFrustum(frustum, found);
+            bvhFrustumMs += millisecondsSince(start);
+
+            expected.clear();
+            start = std::chrono::steady_clock::now();
+            cullSpheres(frustum, bounds, expected);
+            simdFrustumMs += millisecondsSince(start);
+
+            size_t scalarVisible = 0;
+            start = std::chrono::steady_clock::now();
+            for (const glm::vec4& sphere : spheres)
+                scalarVisible += frustum.containsSphere(glm::vec3(sphere), sphere.w);
+            scalarFrustumMs += millisecondsSince(start);
+
+            std::sort(found.begin(), found.end());
+            mismatches += found != expected || scalarVisible != expected.size();
+        }
+
+        // Rays and proximity queries from random points in the volume
+        double bvhRayMs = 0.0, bruteRayMs = 0.0, bvhNearMs = 0.0, bruteNearMs = 0.0;
+        for (int q = 0; q < pointQueries; q++) {
+            glm::vec3 origin(coordinate(random), coordinate(random), coordinate(random));
+            glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)));
+
+            start = std::chrono::steady_clock::now();
+            BvhRayHit hit = bvh.raycast(origin, direction);
+            bvhRayMs += millisecondsSince(start);
+
+            // Same closest-approach test as the hierarchy's leaves; the textbook quadratic loses
+            // grazing hits to cancellation once spheres are a hundred radii away
+            start = std::chrono::steady_clock::now();
+            uint32_t bruteObject = SphereBVH::NONE;
+            float bruteDistance = std::numeric_limits<float>::max();
+            for (size_t i = 0; i < count; i++) {
+                glm::vec3 toOrigin = origin - glm::vec3(spheres[i]);
+                float along = glm::dot(toOrigin, direction);
+                float radiusSquared = spheres[i].w * spheres[i].w;
+                float distance = 0.0f;
+                if (glm::dot(toOrigin, toOrigin) > radiusSquared) {
+                    glm::vec3 closest = toOrigin - along * direction;
+                    float discriminant = radiusSquared - glm::dot(closest, closest);
+                    if (along > 0.0f || discriminant < 0.0f)
+                        continue;
+                    distance = -along - std::sqrt(discriminant);
+                }
+                if (distance < bruteDistance) {
+                    bruteDistance = distance;
+                    bruteObject = uint32_t(i);
+                }
+            }
+            bruteRayMs += millisecondsSince(start);
+            mismatches += hit.object != bruteObject;
+
+            found.clear();
+            start = std::chrono::steady_clock::now();
+            bvh.querySphere(origin, 2.0f, found);
+            bvhNearMs += millisecondsSince(start);
+
+            expected.clear();
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < count; i++) {
+                glm::vec3 toCenter = glm::vec3(spheres[i]) - origin;
+                float reach = 2.0f + spheres[i].w;
+                if (glm::dot(toCenter, toCenter) <= reach * reach)
+                    expected.push_back(uint32_t(i));
+            }
+            bruteNearMs += millisecondsSince(start);
+
+            std::sort(found.begin(), found.end());
+            mismatches += found != expected;
+        }
+
+        std::printf("%9zu %9.2f %9.2f | %9.3f / %7.3f / %7.3f | %9.2f / %9.1f | %9.2f / %9.1f", count, buildMs, refitMs,
+                    bvhFrustumMs / frustumQueries, simdFrustumMs / frustumQueries, scalarFrustumMs / frustumQueries,
+                    1000.0 * bvhRayMs / pointQueries, 1000.0 * bruteRayMs / pointQueries,
+                    1000.0 * bvhNearMs / pointQueries, 1000.0 * bruteNearMs / pointQueries);
+        if (mismatches > 0)
+            std::printf("  %zu queries disagree with brute force", mismatches);
+        std::printf("\n");
+    }
+}
+
+#endif // BENCHMARKS_H
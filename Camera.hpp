@@ -1,3 +1,23 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <cmath>
+#include <cstdint>
+#include "Frustum.hpp"
+
+// View and projection matrices, their product, its inverse and the frustum are
+// cached and rebuilt only when something they depend on changes. GetVersion()
+// moves on with every such change, so per-frame work that only depends on the
+// camera can be skipped on frames where it stays put.
+//
+// The public members are for reading; change them through the methods below so
+// the caches follow.
+//
+// Input can be applied as it arrives (ProcessMouseMovement(), ProcessKeyboard())
+// or queued and consumed by one Update() per frame, which can also smooth it.
 class Camera {
 public:
 
@@ -7,7 +27,12 @@ public:
         LEFT,
         RIGHT
     };
-    
+
+    enum Orientation_Mode {
+        EULER,      // Basis rebuilt from Yaw and Pitch
+        QUATERNION  // Basis read from Orientation, turned once per Update(); Yaw and Pitch are kept for reading
+    };
+
     glm::vec3 Position;
     glm::vec3 Front;
     glm::vec3 Up;
@@ -19,14 +44,19 @@ public:
 
     float MovementSpeed;
     float MouseSensitivity;
-    float Zoom;
-    
-
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), 
-           glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), 
-           float yaw = -90.0f, float pitch = 0.0f) 
-           : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(2.5f), 
-             MouseSensitivity(0.1f), Zoom(45.0f) {
+    float Zoom; // Vertical field of view, in degrees
+
+    Orientation_Mode Mode;
+    glm::quat Orientation; // Maps camera axes (right +x, up +y, front -z) to world space; current in QUATERNION mode
+    float Smoothing; // Rate of Update()'s exponential smoothing, per second; 0 applies input at once
+
+
+    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f),
+           glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f),
+           float yaw = -90.0f, float pitch = 0.0f)
+           : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(2.5f),
+             MouseSensitivity(0.1f), Zoom(45.0f), Mode(EULER), Orientation(1.0f, 0.0f, 0.0f, 0.0f), Smoothing(0.0f), AspectRatio(4.0f / 3.0f), NearPlane(0.1f), FarPlane(100.0f), version(1),
+             pendingLook(0.0f), look(0.0f), velocity(0.0f), viewDirty(true), projectionDirty(true), viewProjectionDirty(true), inverseDirty(true), frustumDirty(true) {
         Position = position;
         WorldUp = up;
         Yaw = yaw;
@@ -34,29 +64,138 @@ public:
         updateCameraVectors();
     }
 
-    glm::mat4 GetViewMatrix() {
-        return glm::lookAt(Position, Position + Front, Up);
+    const glm::mat4& GetViewMatrix() {
+        if (viewDirty) {
+            view = glm::lookAt(Position, Position + Front, Up);
+            viewDirty = false;
+        }
+        return view;
     }
 
-    void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true) {
-        xoffset *= MouseSensitivity;
-        yoffset *= MouseSensitivity;
+    const glm::mat4& GetProjectionMatrix() {
+        if (projectionDirty) {
+            projection = glm::perspective(glm::radians(Zoom), AspectRatio, NearPlane, FarPlane);
+            projectionDirty = false;
+        }
+        return projection;
+    }
 
-        Yaw += xoffset;
-        Pitch += yoffset;
+    const glm::mat4& GetViewProjectionMatrix() {
+        if (viewProjectionDirty) {
+            viewProjection = GetProjectionMatrix() * GetViewMatrix();
+            viewProjectionDirty = false;
+        }
+        return viewProjection;
+    }
 
-        if (constrainPitch) {
-            if (Pitch > 89.0f)
-                Pitch = 89.0f;
-            if (Pitch < -89.0f)
-                Pitch = -89.0f;
+    // Clip space back to world space, e.g. to unproject the cursor
+    const glm::mat4& GetInverseViewProjectionMatrix() {
+        if (inverseDirty) {
+            inverseViewProjection = glm::inverse(GetViewProjectionMatrix());
+            inverseDirty = false;
         }
+        return inverseViewProjection;
+    }
 
-        updateCameraVectors();
+    const Frustum& GetFrustum() {
+        if (frustumDirty) {
+            frustum.extract(GetViewProjectionMatrix());
+            frustumDirty = false;
+        }
+        return frustum;
+    }
+
+    // Changes whenever any of the matrices above would; never 0
+    uint64_t GetVersion() const {
+        return version;
+    }
+
+    void SetPosition(const glm::vec3& position) {
+        if (position != Position) {
+            Position = position;
+            markViewDirty();
+        }
+    }
+
+    void SetZoom(float zoom) {
+        if (zoom != Zoom) {
+            Zoom = zoom;
+            markProjectionDirty();
+        }
+    }
+
+    // aspectRatio is width / height
+    void SetProjection(float aspectRatio, float nearPlane, float farPlane) {
+        if (aspectRatio != AspectRatio || nearPlane != NearPlane || farPlane != FarPlane) {
+            AspectRatio = aspectRatio;
+            NearPlane = nearPlane;
+            FarPlane = farPlane;
+            markProjectionDirty();
+        }
+    }
+
+    // Yaw and Pitch are kept in both modes, so switching leaves the view where it is
+    void SetOrientationMode(Orientation_Mode mode) {
+        if (mode == Mode) {
+            return;
+        }
+        Mode = mode;
+        if (Mode == QUATERNION) {
+            // The rotation updateCameraVectors() describes, for the +y world up it assumes
+            Orientation = glm::angleAxis(glm::radians(-90.0f - Yaw), WorldUp) * glm::angleAxis(glm::radians(Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        }
+    }
+
+    // Turns at once in EULER mode. In QUATERNION mode the movement is queued for the next Update(),
+    // which applies a frame's events as one rotation
+    void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true) {
+        if (Mode == QUATERNION) {
+            QueueMouseMovement(xoffset, yoffset);
+            return;
+        }
+        turn(xoffset * MouseSensitivity, yoffset * MouseSensitivity, constrainPitch);
+    }
+
+    // Adds mouse movement for the next Update(); cheap enough to call per event
+    void QueueMouseMovement(float xoffset, float yoffset) {
+        pendingLook += glm::vec2(xoffset, yoffset);
+    }
+
+    // Once per frame: turns by the queued mouse movement and moves along the held directions.
+    // With Smoothing > 0 both ease in at 1 - exp(-deltaTime * Smoothing) of the remainder per
+    // frame, which comes out the same over a second at any frame rate
+    void Update(float deltaTime, bool forward, bool backward, bool left, bool right) {
+        float blend = Smoothing > 0.0f ? 1.0f - std::exp(-deltaTime * Smoothing) : 1.0f;
+
+        look += pendingLook * MouseSensitivity;
+        pendingLook = glm::vec2(0.0f);
+        glm::vec2 step = look * blend;
+        // Degrees; the tail of the ease is applied at once so a still mouse leaves the camera (and its version) still
+        if (glm::abs(look.x) < 1e-3f && glm::abs(look.y) < 1e-3f)
+            step = look;
+        look -= step;
+        turn(step.x, step.y, true);
+
+        // x along Right, y along Front, in units of MovementSpeed
+        glm::vec2 target(float(right) - float(left), float(forward) - float(backward));
+        // Distance covered while the velocity eases towards the target, integrated exactly
+        glm::vec2 distance = target * deltaTime;
+        if (Smoothing > 0.0f)
+            distance += (velocity - target) * (blend / Smoothing);
+        velocity += (target - velocity) * blend;
+        if (glm::abs(target.x - velocity.x) < 1e-3f && glm::abs(target.y - velocity.y) < 1e-3f)
+            velocity = target;
+        if (distance != glm::vec2(0.0f)) {
+            Position += (Right * distance.x + Front * distance.y) * MovementSpeed;
+            markViewDirty();
+        }
     }
 
     void ProcessKeyboard(Camera_Movement direction, float deltaTime) {
         float velocity = MovementSpeed * deltaTime;
+        if (velocity == 0.0f) {
+            return;
+        }
         if (direction == FORWARD)
             Position += Front * velocity;
         if (direction == BACKWARD)
@@ -65,16 +204,89 @@ public:
             Position -= Right * velocity;
         if (direction == RIGHT)
             Position += Right * velocity;
+        markViewDirty();
     }
 
 private:
+    float AspectRatio;
+    float NearPlane;
+    float FarPlane;
+
+    uint64_t version;
+    glm::vec2 pendingLook; // Mouse movement queued since the last Update()
+    glm::vec2 look; // Turn still to apply, in degrees of yaw and pitch
+    glm::vec2 velocity;
+    bool viewDirty, projectionDirty, viewProjectionDirty, inverseDirty, frustumDirty;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseViewProjection;
+    Frustum frustum;
+
+    void markViewDirty() {
+        viewDirty = true;
+        markProductDirty();
+    }
+
+    void markProjectionDirty() {
+        projectionDirty = true;
+        markProductDirty();
+    }
+
+    void markProductDirty() {
+        viewProjectionDirty = true;
+        inverseDirty = true;
+        frustumDirty = true;
+        version++;
+    }
+
+    // Degrees; events that do not turn the camera (or push against the pitch limit) skip the trig
+    void turn(float yawOffset, float pitchOffset, bool constrainPitch) {
+        float yaw = Yaw + yawOffset;
+        float pitch = Pitch + pitchOffset;
+
+        if (constrainPitch) {
+            if (pitch > 89.0f)
+                pitch = 89.0f;
+            if (pitch < -89.0f)
+                pitch = -89.0f;
+        }
+
+        if (yaw == Yaw && pitch == Pitch) {
+            return;
+        }
+        if (Mode == EULER) {
+            Yaw = yaw;
+            Pitch = pitch;
+            updateCameraVectors();
+            return;
+        }
+
+        // Reached once per Update(). Yaw turns about the world up axis, pitch about the camera's own right axis
+        glm::quat yawTurn = glm::angleAxis(glm::radians(Yaw - yaw), WorldUp);
+        glm::quat pitchTurn = glm::angleAxis(glm::radians(pitch - Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
+        Orientation = glm::normalize(yawTurn * Orientation * pitchTurn);
+        Yaw = yaw;
+        Pitch = pitch;
+        Front = Orientation * glm::vec3(0.0f, 0.0f, -1.0f);
+        Right = Orientation * glm::vec3(1.0f, 0.0f, 0.0f);
+        Up = Orientation * glm::vec3(0.0f, 1.0f, 0.0f);
+        markViewDirty();
+    }
+
     void updateCameraVectors() {
+        float yaw = glm::radians(Yaw);
+        float pitch = glm::radians(Pitch);
+        float cosPitch = cos(pitch);
         glm::vec3 front;
-        front.x = cos(glm::radians(Yaw)) * cos(glm::radians(Pitch));
-        front.y = sin(glm::radians(Pitch));
-        front.z = sin(glm::radians(Yaw)) * cos(glm::radians(Pitch));
+        front.x = cos(yaw) * cosPitch;
+        front.y = sin(pitch);
+        front.z = sin(yaw) * cosPitch;
         Front = glm::normalize(front);
         Right = glm::normalize(glm::cross(Front, WorldUp));
         Up    = glm::normalize(glm::cross(Right, Front));
+        markViewDirty();
     }
-};
\ No newline at end of file
+};
+
+#endif // CAMERA_H
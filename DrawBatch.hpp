@@ -0,0 +1,166 @@
+#ifndef DRAWBATCH_H
+#define DRAWBATCH_H
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <vector>
+#include "graphics.hpp"
+#include "GLState.hpp"
+#include "MeshPool.hpp"
+
+// Layout glMultiDrawElementsIndirect reads from GL_DRAW_INDIRECT_BUFFER
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// Layout glDrawArraysIndirect reads; baseInstance needs GL 4.2
+struct DrawArraysIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint first;
+    GLuint baseInstance;
+};
+
+// Base instances in indirect commands are ignored without ARB_base_instance
+inline bool multiDrawIndirectSupported() {
+    return GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+}
+
+// Collects draws of meshes from one pool that share a program and its uniforms,
+// then submits them together: a single glMultiDrawElementsIndirect where the
+// context supports it, otherwise a loop of base-vertex draws on the pool's VAO.
+class DrawBatch {
+public:
+    explicit DrawBatch(MeshPool& pool)
+        : pool(pool), indirectBuffer(0), indirectCapacity(0), instanceVBO(0), drawCalls(0), multiDraw(multiDrawIndirectSupported()) {}
+
+    ~DrawBatch() {
+        glState().deleteBuffers(1, &indirectBuffer);
+    }
+
+    DrawBatch(const DrawBatch&) = delete;
+    DrawBatch& operator=(const DrawBatch&) = delete;
+
+    void clear() {
+        commands.clear();
+    }
+
+    // Instances index the buffer set with setInstanceBuffer(); without one, instanceCount should stay 1
+    void add(const MeshHandle& mesh, GLuint instanceCount = 1, GLuint firstInstance = 0) {
+        if (instanceCount == 0 || mesh.indexCount == 0) {
+            return;
+        }
+
+        DrawElementsIndirectCommand command;
+        command.count = mesh.indexCount;
+        command.instanceCount = instanceCount;
+        command.firstIndex = mesh.firstIndex;
+        command.baseVertex = mesh.baseVertex;
+        command.baseInstance = firstInstance;
+        commands.push_back(command);
+    }
+
+    // SphereInstance buffer bound to attributes 2 and 3 for every draw; 0 for none
+    void setInstanceBuffer(GLuint vbo) {
+        instanceVBO = vbo;
+    }
+
+    // Forces the per-draw loop even where multi-draw is available, e.g. to compare the two
+    void setMultiDraw(bool enabled) {
+        multiDraw = enabled && multiDrawIndirectSupported();
+    }
+
+    bool usesMultiDraw() const {
+        return multiDraw;
+    }
+
+    void submit() {
+        drawCalls = 0;
+        if (commands.empty()) {
+            return;
+        }
+
+        GLuint vao = pool.getVAO();
+        if (multiDraw) {
+            if (instanceVBO != 0)
+                bindInstancesToVAO(vao, instanceVBO, 2, 0); // Each command's baseInstance picks its range
+
+            upload();
+            glState().bindVertexArray(vao);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, commands.size(), 0);
+            drawCalls = 1;
+        } else {
+            for (const DrawElementsIndirectCommand& command : commands) {
+                void* offset = (void*)(command.firstIndex * sizeof(unsigned int));
+                if (instanceVBO != 0) {
+                    // GL 3.3 has no base instance, so the instance range is selected by moving the attribute pointers
+                    bindInstancesToVAO(vao, instanceVBO, 2, command.baseInstance);
+                    glState().bindVertexArray(vao);
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, offset, command.instanceCount, command.baseVertex);
+                } else {
+                    glState().bindVertexArray(vao);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, offset, command.baseVertex);
+                }
+                drawCalls++;
+            }
+        }
+    }
+
+    // Draws `count` commands that are already in `commandBuffer`, e.g. written by a compute shader.
+    // Multi-draw only: without it the counts would have to be read back first
+    void submitIndirect(GLuint commandBuffer, size_t count) {
+        drawCalls = 0;
+        if (!multiDraw || count == 0) {
+            return;
+        }
+
+        GLuint vao = pool.getVAO();
+        if (instanceVBO != 0)
+            bindInstancesToVAO(vao, instanceVBO, 2, 0);
+        glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glState().bindVertexArray(vao);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, count, 0);
+        drawCalls = 1;
+    }
+
+    size_t getCommandCount() const {
+        return commands.size();
+    }
+
+    // GL draw calls issued by the last submit()
+    size_t getDrawCalls() const {
+        return drawCalls;
+    }
+
+private:
+    MeshPool& pool;
+    GLuint indirectBuffer;
+    size_t indirectCapacity;
+    GLuint instanceVBO;
+    size_t drawCalls;
+    bool multiDraw;
+    std::vector<DrawElementsIndirectCommand> commands;
+
+    // Leaves the buffer bound to GL_DRAW_INDIRECT_BUFFER for the draw
+    void upload() {
+        if (indirectBuffer == 0)
+            glGenBuffers(1, &indirectBuffer);
+        glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+
+        size_t bytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+        if (commands.size() > indirectCapacity) {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, bytes, commands.data(), GL_STREAM_DRAW);
+            indirectCapacity = commands.size();
+        } else {
+            // Orphan the old storage so the driver need not wait for last frame's draws
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(DrawElementsIndirectCommand), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, commands.data());
+        }
+    }
+};
+
+#endif // DRAWBATCH_H
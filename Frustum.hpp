@@ -0,0 +1,183 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "VectorBatch.hpp"
+
+// The six clip planes of a view-projection matrix, in world space, pointing
+// inward and normalized so that dot(plane, (p, 1)) is a signed distance.
+class Frustum {
+public:
+    enum PlaneIndex { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR, PLANE_COUNT };
+
+    Frustum() {
+        for (glm::vec4& plane : planes)
+            plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // Contains everything
+    }
+
+    explicit Frustum(const glm::mat4& viewProjection) {
+        extract(viewProjection);
+    }
+
+    // Gribb-Hartmann: each plane is the w row plus or minus the x, y or z row of the matrix (GL clip space, -w <= z <= w)
+    void extract(const glm::mat4& viewProjection) {
+        const glm::mat4& m = viewProjection;
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[PLANE_LEFT] = row3 + row0;
+        planes[PLANE_RIGHT] = row3 - row0;
+        planes[PLANE_BOTTOM] = row3 + row1;
+        planes[PLANE_TOP] = row3 - row1;
+        planes[PLANE_NEAR] = row3 + row2;
+        planes[PLANE_FAR] = row3 - row2;
+
+        for (glm::vec4& plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    const glm::vec4& getPlane(int index) const {
+        return planes[index];
+    }
+
+    // Conservative: spheres just outside a corner, between two planes, are kept
+    bool containsSphere(const glm::vec3& center, float radius) const {
+        for (const glm::vec4& plane : planes) {
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    bool containsPoint(const glm::vec3& point) const {
+        return containsSphere(point, 0.0f);
+    }
+
+private:
+    glm::vec4 planes[PLANE_COUNT];
+};
+
+// Bounding spheres as separate coordinate arrays, so the batch test loads 4 or 8 of each at once
+struct SphereBounds {
+    std::vector<float> x, y, z, radius;
+
+    void clear() {
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void push_back(const glm::vec3& center, float r) {
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(r);
+    }
+
+    size_t size() const {
+        return x.size();
+    }
+};
+
+// Appends the indices of the spheres that touch the frustum to `visible`, in increasing order; returns how many
+inline size_t cullSpheres(const Frustum& frustum, const SphereBounds& spheres, std::vector<uint32_t>& visible) {
+    size_t count = spheres.size();
+    size_t before = visible.size();
+    const float* x = spheres.x.data();
+    const float* y = spheres.y.data();
+    const float* z = spheres.z.data();
+    const float* r = spheres.radius.data();
+    size_t i = 0;
+
+#ifdef VECTORBATCH_AVX
+    // 8 at a time first; the 4-wide loop below picks up the remainder
+    __m256 planeX8[Frustum::PLANE_COUNT], planeY8[Frustum::PLANE_COUNT], planeZ8[Frustum::PLANE_COUNT], planeW8[Frustum::PLANE_COUNT];
+    for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+        const glm::vec4& plane = frustum.getPlane(p);
+        planeX8[p] = _mm256_set1_ps(plane.x);
+        planeY8[p] = _mm256_set1_ps(plane.y);
+        planeZ8[p] = _mm256_set1_ps(plane.z);
+        planeW8[p] = _mm256_set1_ps(plane.w);
+    }
+    for (; i + 8 <= count; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+        __m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX8[p], vx), _mm256_mul_ps(planeY8[p], vy)),
+                                            _mm256_add_ps(_mm256_mul_ps(planeZ8[p], vz), planeW8[p]));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if (mask & 1)
+                visible.push_back(uint32_t(i + lane));
+        }
+    }
+#endif
+
+#ifdef VECTORBATCH_NEON
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t vx = vld1q_f32(x + i);
+        float32x4_t vy = vld1q_f32(y + i);
+        float32x4_t vz = vld1q_f32(z + i);
+        float32x4_t negativeRadius = vnegq_f32(vld1q_f32(r + i));
+        uint32x4_t inside = vdupq_n_u32(~0u);
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            const glm::vec4& plane = frustum.getPlane(p);
+            float32x4_t distance = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(plane.w), vx, plane.x), vy, plane.y), vz, plane.z);
+            inside = vandq_u32(inside, vcgeq_f32(distance, negativeRadius));
+        }
+        uint32_t lanes[4];
+        vst1q_u32(lanes, inside);
+        for (int lane = 0; lane < 4; lane++) {
+            if (lanes[lane] != 0)
+                visible.push_back(uint32_t(i + lane));
+        }
+    }
+#elif defined(VECTORBATCH_SSE2)
+    __m128 planeX[Frustum::PLANE_COUNT], planeY[Frustum::PLANE_COUNT], planeZ[Frustum::PLANE_COUNT], planeW[Frustum::PLANE_COUNT];
+    for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+        const glm::vec4& plane = frustum.getPlane(p);
+        planeX[p] = _mm_set1_ps(plane.x);
+        planeY[p] = _mm_set1_ps(plane.y);
+        planeZ[p] = _mm_set1_ps(plane.z);
+        planeW[p] = _mm_set1_ps(plane.w);
+    }
+    for (; i + 4 <= count; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < Frustum::PLANE_COUNT; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], vx), _mm_mul_ps(planeY[p], vy)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], vz), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+            if (mask & 1)
+                visible.push_back(uint32_t(i + lane));
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        if (frustum.containsSphere(glm::vec3(x[i], y[i], z[i]), r[i]))
+            visible.push_back(uint32_t(i));
+    }
+
+    return visible.size() - before;
+}
+
+#endif // FRUSTUM_H
@@ -0,0 +1,302 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <GL/glew.h>
+#include <cstddef>
+
+// Mirror of the GL bindings and fixed-function state the renderer touches.
+// Calls that would not change anything are dropped before reaching the
+// driver, which otherwise validates each one. Everything starts out unknown,
+// so the first call of each kind always goes through; call invalidate() after
+// anything changes state behind the cache's back.
+//
+// The element array binding belongs to the bound VAO, so it is never elided.
+class GLStateCache {
+public:
+    static const int TEXTURE_UNITS = 16;
+    static const int UNIFORM_BINDINGS = 16;
+
+    GLStateCache() : issued(0), elided(0) {
+        invalidate();
+    }
+
+    void invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        for (GLuint& buffer : buffers)
+            buffer = UNKNOWN;
+        for (UniformRange& range : uniformRanges)
+            range.buffer = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (GLuint* unit : textures)
+            for (int target = 0; target < TEXTURE_TARGET_COUNT; target++)
+                unit[target] = UNKNOWN;
+        for (int& capability : capabilities)
+            capability = -1;
+        depthMaskValue = -1;
+        depthFuncValue = UNKNOWN;
+        blendSource = blendDestination = UNKNOWN;
+        colorMaskValue = -1;
+    }
+
+    void useProgram(GLuint name) {
+        if (changed(program, name))
+            glUseProgram(name);
+    }
+
+    void bindVertexArray(GLuint name) {
+        if (changed(vertexArray, name))
+            glBindVertexArray(name);
+    }
+
+    void bindBuffer(GLenum target, GLuint name) {
+        int slot = bufferSlot(target);
+        if (slot < 0) {
+            issued++;
+            glBindBuffer(target, name);
+        } else if (changed(buffers[slot], name)) {
+            glBindBuffer(target, name);
+        }
+    }
+
+    // Also sets the generic GL_UNIFORM_BUFFER binding, as GL does
+    void bindBufferRange(GLenum target, GLuint index, GLuint name, GLintptr offset, GLsizeiptr size) {
+        if (target == GL_UNIFORM_BUFFER && index < GLuint(UNIFORM_BINDINGS)) {
+            UniformRange& range = uniformRanges[index];
+            if (range.buffer == name && range.offset == offset && range.size == size) {
+                elided++;
+                return;
+            }
+            range.buffer = name;
+            range.offset = offset;
+            range.size = size;
+        }
+        issued++;
+        glBindBufferRange(target, index, name, offset, size);
+        int slot = bufferSlot(target);
+        if (slot >= 0)
+            buffers[slot] = name;
+    }
+
+    void bindBufferBase(GLenum target, GLuint index, GLuint name) {
+        if (target == GL_UNIFORM_BUFFER && index < GLuint(UNIFORM_BINDINGS)) {
+            UniformRange& range = uniformRanges[index];
+            if (range.buffer == name && range.size == WHOLE_BUFFER) {
+                elided++;
+                return;
+            }
+            range.buffer = name;
+            range.offset = 0;
+            range.size = WHOLE_BUFFER;
+        }
+        issued++;
+        glBindBufferBase(target, index, name);
+        int slot = bufferSlot(target);
+        if (slot >= 0)
+            buffers[slot] = name;
+    }
+
+    void activeTexture(GLuint unit) {
+        if (changed(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // Binds to `unit`, switching the active unit only if the binding changes
+    void bindTexture(GLuint unit, GLenum target, GLuint name) {
+        int slot = textureSlot(target);
+        if (slot < 0 || unit >= GLuint(TEXTURE_UNITS)) {
+            activeTexture(unit);
+            issued++;
+            glBindTexture(target, name);
+            return;
+        }
+        if (textures[unit][slot] == name) {
+            elided++;
+            return;
+        }
+        activeTexture(unit);
+        textures[unit][slot] = name;
+        issued++;
+        glBindTexture(target, name);
+    }
+
+    void enable(GLenum capability) {
+        setCapability(capability, true);
+    }
+
+    void disable(GLenum capability) {
+        setCapability(capability, false);
+    }
+
+    void depthMask(GLboolean enabled) {
+        if (changed(depthMaskValue, enabled ? 1 : 0))
+            glDepthMask(enabled);
+    }
+
+    void depthFunc(GLenum function) {
+        if (changed(depthFuncValue, function))
+            glDepthFunc(function);
+    }
+
+    void blendFunc(GLenum source, GLenum destination) {
+        if (blendSource == source && blendDestination == destination) {
+            elided++;
+            return;
+        }
+        blendSource = source;
+        blendDestination = destination;
+        issued++;
+        glBlendFunc(source, destination);
+    }
+
+    // All four channels together, which is all the renderer needs
+    void colorMask(GLboolean enabled) {
+        if (changed(colorMaskValue, enabled ? 1 : 0))
+            glColorMask(enabled, enabled, enabled, enabled);
+    }
+
+    // GL unbinds deleted objects, so the cache must forget them before their names are reused
+    void deleteBuffers(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; i++) {
+            if (names[i] == 0)
+                continue;
+            for (GLuint& buffer : buffers)
+                if (buffer == names[i])
+                    buffer = 0;
+            for (UniformRange& range : uniformRanges)
+                if (range.buffer == names[i])
+                    range.buffer = 0;
+        }
+        glDeleteBuffers(count, names);
+    }
+
+    void deleteVertexArrays(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; i++)
+            if (names[i] != 0 && vertexArray == names[i])
+                vertexArray = 0;
+        glDeleteVertexArrays(count, names);
+    }
+
+    void deleteTextures(GLsizei count, const GLuint* names) {
+        for (GLsizei i = 0; i < count; i++) {
+            if (names[i] == 0)
+                continue;
+            for (GLuint* unit : textures)
+                for (int target = 0; target < TEXTURE_TARGET_COUNT; target++)
+                    if (unit[target] == names[i])
+                        unit[target] = 0;
+        }
+        glDeleteTextures(count, names);
+    }
+
+    void deleteProgram(GLuint name) {
+        if (name != 0 && program == name)
+            program = UNKNOWN; // Deleting the program in use is deferred, so it stays current
+        glDeleteProgram(name);
+    }
+
+    size_t getIssuedCount() const {
+        return issued;
+    }
+
+    size_t getElidedCount() const {
+        return elided;
+    }
+
+    void resetCounters() {
+        issued = 0;
+        elided = 0;
+    }
+
+private:
+    static const GLuint UNKNOWN = ~0u; // Never a valid object name
+    static const GLsizeiptr WHOLE_BUFFER = -1;
+    static const int BUFFER_TARGET_COUNT = 6;
+    static const int TEXTURE_TARGET_COUNT = 4;
+    static const int CAPABILITY_COUNT = 5;
+
+    struct UniformRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint buffers[BUFFER_TARGET_COUNT];
+    UniformRange uniformRanges[UNIFORM_BINDINGS];
+    GLuint activeUnit;
+    GLuint textures[TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+    int capabilities[CAPABILITY_COUNT]; // -1 unknown, else 0/1
+    int depthMaskValue;
+    GLenum depthFuncValue;
+    GLenum blendSource, blendDestination;
+    int colorMaskValue;
+    size_t issued;
+    size_t elided;
+
+    template <typename T>
+    bool changed(T& current, T value) {
+        if (current == value) {
+            elided++;
+            return false;
+        }
+        current = value;
+        issued++;
+        return true;
+    }
+
+    static int bufferSlot(GLenum target) {
+        switch (target) {
+        case GL_ARRAY_BUFFER: return 0;
+        case GL_COPY_READ_BUFFER: return 1;
+        case GL_COPY_WRITE_BUFFER: return 2;
+        case GL_DRAW_INDIRECT_BUFFER: return 3;
+        case GL_UNIFORM_BUFFER: return 4;
+        case GL_PIXEL_PACK_BUFFER: return 5;
+        default: return -1; // Includes GL_ELEMENT_ARRAY_BUFFER
+        }
+    }
+
+    static int textureSlot(GLenum target) {
+        switch (target) {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_3D: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        case GL_TEXTURE_2D_ARRAY: return 3;
+        default: return -1;
+        }
+    }
+
+    static int capabilitySlot(GLenum capability) {
+        switch (capability) {
+        case GL_DEPTH_TEST: return 0;
+        case GL_BLEND: return 1;
+        case GL_CULL_FACE: return 2;
+        case GL_SCISSOR_TEST: return 3;
+        case GL_STENCIL_TEST: return 4;
+        default: return -1;
+        }
+    }
+
+    void setCapability(GLenum capability, bool enabled) {
+        int slot = capabilitySlot(capability);
+        if (slot >= 0 && !changed(capabilities[slot], enabled ? 1 : 0)) {
+            return;
+        }
+        if (slot < 0)
+            issued++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+};
+
+// The one cache for the single GL context
+inline GLStateCache& glState() {
+    static GLStateCache cache;
+    return cache;
+}
+
+#endif // GLSTATE_H
@@ -0,0 +1,183 @@
+#ifndef ICOSPHERETABLES_H
+#define ICOSPHERETABLES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "graphics.hpp"
+
+// The base icosahedron and its first few subdivision levels, computed by the
+// compiler. The tables live in read-only data, so small spheres cost nothing to
+// produce. Vertex and face order match createIndexedIcosphere().
+
+const int ICOSPHERE_TABLE_MAX_LEVEL = 3;
+
+// Both counts are 0 for a negative level, which has no sphere
+constexpr size_t icosphereVertexCount(int level) {
+    assert(level >= 0);
+    if (level < 0)
+        return 0;
+    return 10 * (size_t(1) << (2 * level)) + 2;
+}
+
+constexpr size_t icosphereIndexCount(int level) {
+    assert(level >= 0);
+    if (level < 0)
+        return 0;
+    return 60 * (size_t(1) << (2 * level));
+}
+
+// Newton iteration; converges to the correctly rounded double for the values used here
+constexpr double constexprSqrt(double x) {
+    double guess = x > 1.0 ? x : 1.0;
+    for (int i = 0; i < 64; i++) {
+        double next = 0.5 * (guess + x / guess);
+        if (next == guess)
+            break;
+        guess = next;
+    }
+    return guess;
+}
+
+constexpr Vec3 constexprNormalize(double x, double y, double z) {
+    double length = constexprSqrt(x * x + y * y + z * z);
+    return Vec3(float(x / length), float(y / length), float(z / length));
+}
+
+constexpr double GOLDEN_RATIO = (1.0 + 2.23606797749978969640) / 2.0; // (1 + sqrt(5)) / 2
+
+constexpr std::array<Vec3, 12> ICOSAHEDRON_VERTICES = {{
+    constexprNormalize(-1,  GOLDEN_RATIO,  0), constexprNormalize( 1,  GOLDEN_RATIO,  0),
+    constexprNormalize(-1, -GOLDEN_RATIO,  0), constexprNormalize( 1, -GOLDEN_RATIO,  0),
+    constexprNormalize( 0, -1,  GOLDEN_RATIO), constexprNormalize( 0,  1,  GOLDEN_RATIO),
+    constexprNormalize( 0, -1, -GOLDEN_RATIO), constexprNormalize( 0,  1, -GOLDEN_RATIO),
+    constexprNormalize( GOLDEN_RATIO,  0, -1), constexprNormalize( GOLDEN_RATIO,  0,  1),
+    constexprNormalize(-GOLDEN_RATIO,  0, -1), constexprNormalize(-GOLDEN_RATIO,  0,  1)
+}};
+
+constexpr std::array<unsigned int, 60> ICOSAHEDRON_FACES = {{
+    // 5 faces around point 0
+    0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
+    // Adjacent faces
+    1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
+    // 5 faces around 3
+    3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
+    // Adjacent faces
+    4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
+}};
+
+template <int Level>
+struct IcosphereTable {
+    std::array<Vec3, icosphereVertexCount(Level)> vertices;
+    std::array<unsigned int, icosphereIndexCount(Level)> indices;
+};
+
+// Every icosphere vertex has at most 6 neighbours, so edge midpoints are looked
+// up in a small per-vertex table instead of a hash map
+template <int Level>
+struct IcosphereMidpoints {
+    std::array<std::array<unsigned int, 6>, icosphereVertexCount(Level)> neighbour;
+    std::array<std::array<unsigned int, 6>, icosphereVertexCount(Level)> midpoint;
+    std::array<unsigned int, icosphereVertexCount(Level)> count;
+};
+
+template <int Level>
+constexpr unsigned int constexprMidpoint(IcosphereTable<Level + 1>& table, IcosphereMidpoints<Level>& midpoints,
+                                         unsigned int& nextVertex, unsigned int a, unsigned int b) {
+    unsigned int low = a < b ? a : b;
+    unsigned int high = a < b ? b : a;
+
+    for (unsigned int i = 0; i < midpoints.count[low]; i++) {
+        if (midpoints.neighbour[low][i] == high)
+            return midpoints.midpoint[low][i];
+    }
+
+    const Vec3& va = table.vertices[a];
+    const Vec3& vb = table.vertices[b];
+    unsigned int index = nextVertex++;
+    table.vertices[index] = constexprNormalize(double(va.x + vb.x), double(va.y + vb.y), double(va.z + vb.z));
+
+    unsigned int slot = midpoints.count[low]++;
+    midpoints.neighbour[low][slot] = high;
+    midpoints.midpoint[low][slot] = index;
+
+    return index;
+}
+
+template <int Level>
+constexpr IcosphereTable<Level> buildIcosphereTable() {
+    IcosphereTable<Level> table{};
+
+    if constexpr (Level == 0) {
+        for (size_t i = 0; i < ICOSAHEDRON_VERTICES.size(); i++)
+            table.vertices[i] = ICOSAHEDRON_VERTICES[i];
+        for (size_t i = 0; i < ICOSAHEDRON_FACES.size(); i++)
+            table.indices[i] = ICOSAHEDRON_FACES[i];
+    } else {
+        constexpr IcosphereTable<Level - 1> parent = buildIcosphereTable<Level - 1>();
+        IcosphereMidpoints<Level - 1> midpoints{};
+
+        for (size_t i = 0; i < parent.vertices.size(); i++)
+            table.vertices[i] = parent.vertices[i];
+        unsigned int nextVertex = parent.vertices.size();
+
+        // Same child order and winding as createIndexedIcosphere()
+        for (size_t face = 0; face < parent.indices.size() / 3; face++) {
+            unsigned int v1 = parent.indices[3 * face];
+            unsigned int v2 = parent.indices[3 * face + 1];
+            unsigned int v3 = parent.indices[3 * face + 2];
+
+            unsigned int mid1 = constexprMidpoint<Level - 1>(table, midpoints, nextVertex, v1, v2);
+            unsigned int mid2 = constexprMidpoint<Level - 1>(table, midpoints, nextVertex, v2, v3);
+            unsigned int mid3 = constexprMidpoint<Level - 1>(table, midpoints, nextVertex, v3, v1);
+
+            const unsigned int children[12] = {
+                v1, mid1, mid3,
+                v2, mid2, mid1,
+                v3, mid3, mid2,
+                mid1, mid2, mid3
+            };
+            for (size_t i = 0; i < 12; i++)
+                table.indices[12 * face + i] = children[i];
+        }
+    }
+
+    return table;
+}
+
+template <int Level>
+inline constexpr IcosphereTable<Level> ICOSPHERE_TABLE = buildIcosphereTable<Level>();
+
+template <int Level>
+MeshView makeMeshView(const IcosphereTable<Level>& table) {
+    MeshView view;
+    view.vertices = table.vertices.data();
+    view.vertexCount = table.vertices.size();
+    view.normals = nullptr; // Positions double as normals on the unit sphere
+    view.indices = table.indices.data();
+    view.indexCount = table.indices.size();
+
+    return view;
+}
+
+// Precomputed indexed icosphere for 0 <= level <= ICOSPHERE_TABLE_MAX_LEVEL; an empty view otherwise
+inline MeshView icosphereTableView(int level) {
+    switch (level) {
+    case 0: return makeMeshView(ICOSPHERE_TABLE<0>);
+    case 1: return makeMeshView(ICOSPHERE_TABLE<1>);
+    case 2: return makeMeshView(ICOSPHERE_TABLE<2>);
+    case 3: return makeMeshView(ICOSPHERE_TABLE<3>);
+    default: {
+        assert(false && "icosphere table level out of range");
+        MeshView empty = { nullptr, 0, nullptr, nullptr, 0 };
+        return empty;
+    }
+    }
+}
+
+static_assert(ICOSPHERE_TABLE_MAX_LEVEL == 3, "icosphereTableView() covers levels 0-3");
+
+#endif // ICOSPHERETABLES_H
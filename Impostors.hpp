@@ -0,0 +1,52 @@
+#ifndef IMPOSTORS_H
+#define IMPOSTORS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstddef>
+#include "graphics.hpp"
+#include "GLState.hpp"
+
+// Spheres drawn as camera-facing quads that the fragment shader ray-casts
+// against the exact sphere, writing its depth and normal. Two triangles per
+// sphere at any size; only the SphereInstance buffer is read, so there is no
+// vertex buffer: the corners come from gl_VertexID.
+class SphereImpostorRenderer {
+public:
+    SphereImpostorRenderer() : VAO(0) {
+        glGenVertexArrays(1, &VAO);
+    }
+
+    ~SphereImpostorRenderer() {
+        glState().deleteVertexArrays(1, &VAO);
+    }
+
+    SphereImpostorRenderer(const SphereImpostorRenderer&) = delete;
+    SphereImpostorRenderer& operator=(const SphereImpostorRenderer&) = delete;
+
+    // The impostor program must be in use
+    void render(GLuint instanceVBO, size_t firstInstance, GLsizei instanceCount) {
+        if (instanceCount <= 0) {
+            return;
+        }
+
+        bindInstancesToVAO(VAO, instanceVBO, 0, firstInstance);
+
+        glState().bindVertexArray(VAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, instanceCount);
+    }
+
+    // Instance count and base instance come from the DrawArraysIndirectCommand at byte `offset` of commandBuffer (GL 4.2)
+    void renderIndirect(GLuint instanceVBO, GLuint commandBuffer, size_t offset) {
+        bindInstancesToVAO(VAO, instanceVBO, 0, 0);
+
+        glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        glState().bindVertexArray(VAO);
+        glDrawArraysIndirect(GL_TRIANGLE_STRIP, (void*)offset);
+    }
+
+private:
+    GLuint VAO;
+};
+
+#endif // IMPOSTORS_H
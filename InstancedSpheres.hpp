@@ -0,0 +1,490 @@
+#ifndef INSTANCEDSPHERES_H
+#define INSTANCEDSPHERES_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+#include "graphics.hpp"
+#include "Object.hpp"
+#include "Impostors.hpp"
+#include "DrawBatch.hpp"
+#include "StreamBuffer.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+#include "Occlusion.hpp"
+
+// Draws any number of spheres with one instanced draw per LOD level. The mesh
+// (and its LOD chain) is shared; each sphere is one SphereInstance in a
+// per-instance stream, regrouped by level every frame. Spheres smaller than
+// impostorRadiusPixels on screen are grouped last and left to renderImpostors().
+// A pooled mesh submits all its level groups as one multi-draw when possible.
+//
+// With an OcclusionCuller set, spheres hidden last frame are held back from
+// render(); once the rest of the scene is drawn, cullOccluded() tests them
+// against the depth buffer and renderRevealed() draws the ones that show.
+class InstancedSphereRenderer {
+public:
+    // The stream's owner ends its frame after renderImpostors()
+    InstancedSphereRenderer(RenderableObject& mesh, StreamBuffer& stream)
+        : mesh(mesh), stream(stream), occlusion(nullptr), instanceVBO(0), instanceOffset(0), idOffset(0), drawCalls(0), impostorRadiusPixels(0.0f),
+          impostorFirst(0), impostorCount(0), instanceBase(0), deferredFirst(0), deferredCount(0), hiZ(false), nearPlane(0.0f), frameStamp(0),
+          selectionVersion(0), selectionImpostorRadius(0.0f), selectionPixelError(0.0f), selectionViewportHeight(0.0f), instancesChanged(true) {
+        if (mesh.getPool() != nullptr)
+            batch.reset(new DrawBatch(*mesh.getPool()));
+    }
+
+    InstancedSphereRenderer(const InstancedSphereRenderer&) = delete;
+    InstancedSphereRenderer& operator=(const InstancedSphereRenderer&) = delete;
+
+    void setInstances(const std::vector<SphereInstance>& instances) {
+        this->instances = instances;
+        std::vector<glm::vec4> spheres(instances.size());
+        for (size_t i = 0; i < instances.size(); i++)
+            spheres[i] = instances[i].positionRadius;
+        bvh.build(spheres);
+
+        bvh.collectClusters(CLUSTER_SIZE, clusters);
+        clusterOf.resize(instances.size());
+        for (uint32_t cluster = 0; cluster < clusters.size(); cluster++) {
+            const uint32_t* objects = bvh.getNodeObjects(clusters[cluster]);
+            for (uint32_t i = 0; i < bvh.getNodeObjectCount(clusters[cluster]); i++)
+                clusterOf[objects[i]] = cluster;
+        }
+        clusterStamp.assign(clusters.size(), 0);
+        clusterCrossesNear.assign(clusters.size(), 0);
+        frameStamp = 0;
+        instancesChanged = true;
+        setOcclusionCuller(occlusion);
+    }
+
+    // Moves one sphere without rebuilding the hierarchy; the next render() refits it
+    void moveInstance(size_t index, const glm::vec3& center, float radius) {
+        instances[index].positionRadius = glm::vec4(center, radius);
+        bvh.update(uint32_t(index), center, radius);
+        instancesChanged = true;
+    }
+
+    void setInstanceColor(size_t index, const glm::vec3& color) {
+        instances[index].color = glm::vec4(color, 1.0f);
+        instancesChanged = true;
+    }
+
+    // Changes go through setInstances() and moveInstance(), which keep the hierarchy in step
+    const std::vector<SphereInstance>& getInstances() const {
+        return instances;
+    }
+
+    // For ray picking and proximity queries; object ids are instance indices
+    const SphereBVH& getHierarchy() {
+        bvh.refit();
+        return bvh;
+    }
+
+    // 0 disables impostors; a huge value sends every sphere to them
+    void setImpostorRadiusPixels(float radius) {
+        impostorRadiusPixels = radius;
+    }
+
+    // Turns on two-pass occlusion culling for the following frames; nullptr turns it off
+    void setOcclusionCuller(OcclusionCuller* culler) {
+        occlusion = culler;
+        wasVisible.assign(instances.size(), 1);
+        pendingClusters.clear();
+    }
+
+    // Drops spheres outside the frustum, picks a level for the rest, uploads them grouped by level and draws each mesh group.
+    // With occlusion culling on, spheres that were hidden last frame are uploaded too but held back for cullOccluded().
+    // A nonzero viewVersion stands for the frustum, camera position and projection (see Camera::GetVersion()); while it
+    // and the instances stay the same, the last selection is uploaded again without culling, level picking or sorting
+    void render(const Frustum& frustum, const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError = 1.0f,
+                uint64_t viewVersion = 0) {
+        drawCalls = 0;
+        impostorFirst = 0;
+        impostorCount = 0;
+
+        // Occlusion results change the selection from frame to frame, so it is never kept then
+        bool unchanged = viewVersion != 0 && viewVersion == selectionVersion && !instancesChanged && occlusion == nullptr &&
+                         impostorRadiusPixels == selectionImpostorRadius && pixelError == selectionPixelError && viewportHeight == selectionViewportHeight;
+        if (!unchanged) {
+            select(frustum, cameraPosition, projection, viewportHeight, pixelError);
+            selectionVersion = occlusion == nullptr ? viewVersion : 0;
+            selectionImpostorRadius = impostorRadiusPixels;
+            selectionPixelError = pixelError;
+            selectionViewportHeight = viewportHeight;
+            instancesChanged = false;
+        }
+        if (sorted.empty()) {
+            return;
+        }
+
+        // Aligned to whole instances, so the write position is just more instances to skip
+        if (!hiZ) {
+            instanceOffset = stream.write(sorted.data(), sorted.size() * sizeof(SphereInstance), sizeof(SphereInstance));
+        } else {
+            // The pyramid test reads the instances and their ids as storage buffers, which may need a coarser
+            // alignment. One write, since a stream that grows on the second would drop the first
+            size_t alignment = std::max(sizeof(SphereInstance), OcclusionCuller::storageOffsetAlignment());
+            size_t instanceBytes = sorted.size() * sizeof(SphereInstance);
+            size_t idStart = (instanceBytes + alignment - 1) / alignment * alignment;
+            upload.resize(idStart + sortedIds.size() * sizeof(uint32_t));
+            std::memcpy(upload.data(), sorted.data(), instanceBytes);
+            std::memcpy(upload.data() + idStart, sortedIds.data(), sortedIds.size() * sizeof(uint32_t));
+            instanceOffset = stream.write(upload.data(), upload.size(), alignment);
+            idOffset = instanceOffset + idStart;
+        }
+        instanceVBO = stream.getBuffer();
+        instanceBase = instanceOffset / sizeof(SphereInstance);
+
+        size_t levelCount = mesh.getLodCount();
+        drawLevels(&groupStart[0]);
+        impostorFirst = instanceBase + groupStart[levelCount];
+        impostorCount = groupStart[levelCount + 1] - groupStart[levelCount];
+    }
+
+    // Draws the impostor group picked by the last render(); the impostor program must be in use
+    void renderImpostors(SphereImpostorRenderer& impostors) {
+        if (impostorCount > 0) {
+            impostors.render(instanceVBO, impostorFirst, impostorCount);
+            drawCalls++;
+        }
+    }
+
+    // Second pass, after everything that occludes has been drawn: tests the spheres render() held back
+    // against the depth buffer, and every other visible one to pick the next frame's first pass
+    void cullOccluded(const glm::mat4& viewProjection, int viewportWidth, int viewportHeight) {
+        if (occlusion == nullptr || visible.empty()) {
+            return;
+        }
+
+        if (hiZ) {
+            size_t bucketCount = mesh.getLodCount() + 1;
+            std::vector<MeshHandle> levels(mesh.getLodCount());
+            for (size_t level = 0; level < levels.size(); level++)
+                levels[level] = mesh.getLodLevel(level);
+            std::vector<GLuint> bucketStart(bucketCount + 1, 0);
+            if (deferredCount > 0) {
+                for (size_t bucket = 0; bucket <= bucketCount; bucket++)
+                    bucketStart[bucket] = GLuint(groupStart[bucketCount + bucket] - groupStart[bucketCount]);
+            }
+
+            occlusion->buildPyramid(viewportWidth, viewportHeight);
+            occlusion->testSpheres(viewProjection, instanceVBO, instanceOffset, idOffset, visible.size(), deferredFirst, levels, bucketStart, instances.size());
+            return;
+        }
+
+        if (occlusion->getQueryCount() != clusters.size()) {
+            occlusion->setQueryCount(clusters.size());
+            pendingClusters.clear();
+        }
+
+        // Every cluster of a held-back group needs a fresh query for its conditional render; the others
+        // keep an older query in flight rather than restart it
+        // (held back this frame: frameStamp, tested: frameStamp + 1)
+        frameStamp += 2;
+        for (uint32_t cluster : groupClusters)
+            clusterStamp[cluster] = frameStamp;
+        occlusion->beginQueries(viewProjection);
+        for (size_t i = 0; i < visible.size(); i++) {
+            uint32_t cluster = clusterOf[visible[i]];
+            bool deferred = clusterStamp[cluster] == frameStamp;
+            if (clusterStamp[cluster] == frameStamp + 1 || (!deferred && occlusion->isPending(cluster))) {
+                continue;
+            }
+            clusterStamp[cluster] = frameStamp + 1;
+
+            uint32_t node = clusters[cluster];
+            const glm::vec3& boxMin = bvh.getNodeMin(node);
+            const glm::vec3& boxMax = bvh.getNodeMax(node);
+            glm::vec3 normal(nearPlane);
+            glm::vec3 nearest(normal.x >= 0.0f ? boxMin.x : boxMax.x, normal.y >= 0.0f ? boxMin.y : boxMax.y, normal.z >= 0.0f ? boxMin.z : boxMax.z);
+            clusterCrossesNear[cluster] = glm::dot(normal, nearest) + nearPlane.w < 0.0f;
+            if (clusterCrossesNear[cluster]) {
+                // Parts of the box are clipped away, so a query could miss it: count it as visible
+                setClusterVisible(cluster, true);
+                continue;
+            }
+
+            if (!occlusion->isPending(cluster))
+                pendingClusters.push_back(cluster);
+            occlusion->queryBox(cluster, boxMin, boxMax);
+        }
+        occlusion->endQueries();
+    }
+
+    // Draws the held-back spheres that passed cullOccluded(); the mesh program must be in use
+    void renderRevealed() {
+        if (occlusion == nullptr || deferredCount == 0) {
+            return;
+        }
+
+        size_t levelCount = mesh.getLodCount();
+        if (hiZ) {
+            batch->setInstanceBuffer(occlusion->getSurvivorBuffer());
+            batch->submitIndirect(occlusion->getCommandBuffer(), levelCount);
+            drawCalls += batch->getDrawCalls();
+            return;
+        }
+
+        size_t bucketCount = levelCount + 1;
+        for (size_t group = 1; group <= groupClusters.size(); group++) {
+            const size_t* start = &groupStart[group * bucketCount];
+            if (start[levelCount] == start[0]) {
+                continue;
+            }
+            uint32_t cluster = groupClusters[group - 1];
+            if (!clusterCrossesNear[cluster])
+                occlusion->beginConditionalRender(cluster);
+            drawLevels(start);
+            if (!clusterCrossesNear[cluster])
+                occlusion->endConditionalRender();
+        }
+    }
+
+    // Impostors among them; the impostor program must be in use
+    void renderRevealedImpostors(SphereImpostorRenderer& impostors) {
+        if (occlusion == nullptr || deferredCount == 0) {
+            return;
+        }
+
+        size_t levelCount = mesh.getLodCount();
+        if (hiZ) {
+            impostors.renderIndirect(occlusion->getSurvivorBuffer(), occlusion->getCommandBuffer(), levelCount * sizeof(DrawElementsIndirectCommand));
+            drawCalls++;
+            return;
+        }
+
+        size_t bucketCount = levelCount + 1;
+        for (size_t group = 1; group <= groupClusters.size(); group++) {
+            const size_t* start = &groupStart[group * bucketCount];
+            size_t count = start[bucketCount] - start[levelCount];
+            if (count == 0) {
+                continue;
+            }
+            uint32_t cluster = groupClusters[group - 1];
+            if (!clusterCrossesNear[cluster])
+                occlusion->beginConditionalRender(cluster);
+            impostors.render(instanceVBO, instanceBase + start[levelCount], count);
+            drawCalls++;
+            if (!clusterCrossesNear[cluster])
+                occlusion->endConditionalRender();
+        }
+    }
+
+    size_t getImpostorCount() const {
+        return impostorCount;
+    }
+
+    size_t getInstanceCount() const {
+        return instances.size();
+    }
+
+    // Spheres that passed the frustum test in the last render()
+    size_t getVisibleCount() const {
+        return visible.size();
+    }
+
+    // Of those, the ones held back for the occlusion test
+    size_t getDeferredCount() const {
+        return deferredCount;
+    }
+
+    size_t getDrawCalls() const {
+        return drawCalls;
+    }
+
+    // nullptr unless the mesh lives in a pool
+    DrawBatch* getBatch() {
+        return batch.get();
+    }
+
+private:
+    static const uint32_t CLUSTER_SIZE = 64; // Spheres per occlusion query, at most
+
+    RenderableObject& mesh;
+    std::unique_ptr<DrawBatch> batch;
+    StreamBuffer& stream;
+    OcclusionCuller* occlusion;
+    GLuint instanceVBO; // Stream buffer of the last render(); it changes when the stream grows
+    size_t instanceOffset, idOffset; // Of the last render()'s upload, in bytes
+    size_t drawCalls; // Issued by the last render() and renderImpostors()
+    float impostorRadiusPixels;
+    size_t impostorFirst;
+    size_t impostorCount;
+    size_t instanceBase; // First instance of the last render()'s upload in the stream
+    std::vector<SphereInstance> instances;
+    SphereBVH bvh; // Over the instances' bounding spheres
+    std::vector<uint32_t> visible;
+    std::vector<SphereInstance> sorted;
+    std::vector<uint32_t> sortedIds; // Object of each sorted instance, for the pyramid test
+    std::vector<unsigned char> upload; // Both of the above, as written to the stream
+    std::vector<size_t> keyOf; // Group and bucket of each visible sphere
+    std::vector<size_t> groupStart; // Instance ranges per group and bucket
+    size_t deferredFirst, deferredCount; // Sorted instances held back for cullOccluded()
+    bool hiZ; // Whether this frame's occlusion test uses the pyramid
+    glm::vec4 nearPlane;
+
+    // Occlusion state; clusters are BVH nodes, fixed until the next setInstances()
+    std::vector<uint8_t> wasVisible; // Per instance, as last reported by the GPU
+    std::vector<uint32_t> visibilityBits;
+    std::vector<uint32_t> clusters;
+    std::vector<uint32_t> clusterOf; // Per instance
+    std::vector<uint32_t> clusterStamp;
+    std::vector<uint8_t> clusterCrossesNear;
+    std::vector<uint32_t> groupClusters; // Cluster of each held-back group after the first
+    std::vector<uint32_t> pendingClusters; // Queried, result not read yet
+    uint32_t frameStamp;
+
+    // What the current selection was made for; see render()
+    uint64_t selectionVersion;
+    float selectionImpostorRadius;
+    float selectionPixelError;
+    float selectionViewportHeight;
+    bool instancesChanged;
+
+    // Culls, picks levels and sorts into `sorted`, with instance ranges per group and bucket in groupStart
+    void select(const Frustum& frustum, const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError) {
+        deferredCount = 0;
+        groupClusters.clear();
+        visible.clear();
+        sorted.clear();
+        bvh.refit();
+        bvh.queryFrustum(frustum, visible);
+        nearPlane = frustum.getPlane(Frustum::PLANE_NEAR);
+        hiZ = occlusion != nullptr && occlusion->usesHiZ() && batch != nullptr && batch->usesMultiDraw() && mesh.getLodCount() < size_t(OcclusionCuller::MAX_BUCKETS);
+        if (occlusion != nullptr)
+            collectOcclusionResults();
+        if (visible.empty()) {
+            return;
+        }
+
+        // One extra bucket after the mesh levels holds the impostors
+        size_t levelCount = mesh.getLodCount();
+        size_t bucketCount = levelCount + 1;
+
+        // Group 0 is drawn now. Spheres hidden last frame wait in later groups: one for the pyramid test,
+        // or one per run of the same BVH cluster for occlusion queries
+        size_t groupCount = 1;
+        uint32_t runCluster = SphereBVH::NONE;
+        keyOf.resize(visible.size());
+        for (size_t i = 0; i < visible.size(); i++) {
+            uint32_t object = visible[i];
+            const glm::vec4& sphere = instances[object].positionRadius;
+            glm::vec3 center(sphere);
+            size_t bucket;
+            if (impostorRadiusPixels > 0.0f && projectedSphereRadius(center, sphere.w, cameraPosition, projection, viewportHeight) < impostorRadiusPixels)
+                bucket = levelCount;
+            else
+                bucket = mesh.lodFor(center, sphere.w, cameraPosition, projection, viewportHeight, pixelError);
+
+            size_t group = 0;
+            if (occlusion != nullptr && !wasVisible[object]) {
+                if (hiZ) {
+                    groupCount = 2;
+                } else if (clusterOf[object] != runCluster) {
+                    runCluster = clusterOf[object];
+                    groupClusters.push_back(runCluster);
+                    groupCount++;
+                }
+                group = groupCount - 1;
+            }
+            keyOf[i] = group * bucketCount + bucket;
+        }
+
+        // Counting sort into contiguous per-group, per-level ranges
+        size_t keyCount = groupCount * bucketCount;
+        groupStart.assign(keyCount + 1, 0);
+        for (size_t key : keyOf)
+            groupStart[key + 1]++;
+        for (size_t key = 0; key < keyCount; key++)
+            groupStart[key + 1] += groupStart[key];
+
+        sorted.resize(visible.size());
+        sortedIds.resize(hiZ ? visible.size() : 0);
+        std::vector<size_t> fill(groupStart.begin(), groupStart.end() - 1);
+        for (size_t i = 0; i < visible.size(); i++) {
+            size_t position = fill[keyOf[i]]++;
+            sorted[position] = instances[visible[i]];
+            if (hiZ)
+                sortedIds[position] = visible[i];
+        }
+        deferredFirst = groupStart[bucketCount];
+        deferredCount = visible.size() - deferredFirst;
+    }
+
+    // Mesh levels of one group, bucket b in sorted instances [start[b], start[b + 1])
+    void drawLevels(const size_t* start) {
+        size_t levelCount = mesh.getLodCount();
+        if (batch != nullptr) {
+            batch->clear();
+            batch->setInstanceBuffer(instanceVBO);
+            for (size_t level = 0; level < levelCount; level++)
+                batch->add(mesh.getLodLevel(level), start[level + 1] - start[level], instanceBase + start[level]);
+            batch->submit();
+            drawCalls += batch->getDrawCalls();
+        } else {
+            for (size_t level = 0; level < levelCount; level++) {
+                GLsizei count = start[level + 1] - start[level];
+                if (count > 0) {
+                    mesh.renderInstanced(level, instanceVBO, instanceBase + start[level], count);
+                    drawCalls++;
+                }
+            }
+        }
+    }
+
+    // Whatever the GPU has finished reporting since the last frame; results still in flight keep the old state
+    void collectOcclusionResults() {
+        if (hiZ) {
+            if (occlusion->readVisibility(visibilityBits)) {
+                for (size_t i = 0; i < instances.size(); i++)
+                    wasVisible[i] = (visibilityBits[i >> 5] >> (i & 31)) & 1;
+            }
+            return;
+        }
+
+        if (occlusion->getQueryCount() != clusters.size()) {
+            return;
+        }
+        for (size_t i = 0; i < pendingClusters.size();) {
+            bool clusterVisible = false;
+            if (occlusion->pollQuery(pendingClusters[i], clusterVisible)) {
+                setClusterVisible(pendingClusters[i], clusterVisible);
+                pendingClusters[i] = pendingClusters.back();
+                pendingClusters.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+
+    void setClusterVisible(uint32_t cluster, bool clusterVisible) {
+        uint32_t node = clusters[cluster];
+        const uint32_t* objects = bvh.getNodeObjects(node);
+        for (uint32_t i = 0; i < bvh.getNodeObjectCount(node); i++)
+            wasVisible[objects[i]] = clusterVisible;
+    }
+};
+
+// Randomly placed and coloured spheres filling a cube of half-size `extent` around the origin
+inline std::vector<SphereInstance> createSphereField(size_t count, float extent, unsigned int seed = 1) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> coordinate(-extent, extent);
+    std::uniform_real_distribution<float> radius(0.05f, 0.3f);
+    std::uniform_real_distribution<float> channel(0.2f, 1.0f);
+
+    std::vector<SphereInstance> instances(count);
+    for (SphereInstance& instance : instances) {
+        instance.positionRadius = glm::vec4(coordinate(random), coordinate(random), coordinate(random), radius(random));
+        instance.color = glm::vec4(channel(random), channel(random), channel(random), 1.0f);
+    }
+
+    return instances;
+}
+
+#endif // INSTANCEDSPHERES_H
@@ -0,0 +1,260 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "graphics.hpp"
+#include "MeshOptimizer.hpp"
+
+// Binary cache of generated sphere meshes. Files are laid out so the mapped
+// bytes can be handed to createVBO()/createEBO() as they are: a fixed header
+// followed by the position, normal and index blocks.
+
+enum MeshLayout {
+    MESH_LAYOUT_POSITIONS,        // Vec3 positions only, normals derived in the shader
+    MESH_LAYOUT_POSITIONS_NORMALS // Vec3 positions plus a separate glm::vec3 normal block
+};
+
+struct MeshCacheKey {
+    int subdivisions;
+    MeshLayout layout;
+    bool indexed;
+};
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t subdivisions;
+    uint32_t layout;
+    uint32_t indexed;
+    uint32_t reserved;
+    uint64_t vertexCount;
+    uint64_t indexCount;
+    uint64_t positionsOffset;
+    uint64_t normalsOffset; // 0 when the layout has no normals
+    uint64_t indicesOffset; // 0 for non-indexed meshes
+};
+
+const char MESH_CACHE_MAGIC[4] = { 'S', 'P', 'H', 'M' };
+const uint32_t MESH_CACHE_VERSION = 2; // 2: indexed meshes are stored cache/fetch optimized
+
+inline std::string meshCachePath(const std::string& cacheDir, const MeshCacheKey& key) {
+    return cacheDir + "/icosphere_s" + std::to_string(key.subdivisions)
+         + "_l" + std::to_string(int(key.layout))
+         + (key.indexed ? "_indexed" : "_soup") + ".mesh";
+}
+
+// Writes to a temporary file and renames it into place, so a reader never maps a partial file
+inline bool writeMeshCache(const std::string& path, const MeshCacheKey& key, const MeshView& mesh) {
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.subdivisions = key.subdivisions;
+    header.layout = key.layout;
+    header.indexed = key.indexed;
+    header.vertexCount = mesh.vertexCount;
+    header.indexCount = mesh.indices != nullptr ? mesh.indexCount : 0;
+
+    uint64_t offset = sizeof(MeshCacheHeader);
+    header.positionsOffset = offset;
+    offset += header.vertexCount * sizeof(Vec3);
+    if (mesh.normals != nullptr) {
+        header.normalsOffset = offset;
+        offset += header.vertexCount * sizeof(glm::vec3);
+    }
+    if (header.indexCount > 0) {
+        header.indicesOffset = offset;
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && std::fwrite(mesh.vertices, sizeof(Vec3), mesh.vertexCount, file) == mesh.vertexCount;
+    if (mesh.normals != nullptr)
+        ok = ok && std::fwrite(mesh.normals, sizeof(glm::vec3), mesh.vertexCount, file) == mesh.vertexCount;
+    if (header.indexCount > 0)
+        ok = ok && std::fwrite(mesh.indices, sizeof(unsigned int), header.indexCount, file) == header.indexCount;
+    ok = (std::fclose(file) == 0) && ok;
+
+    if (!ok || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// A sphere mesh backed either by a read-only mapping of its cache file or, if
+// the cache could not be written, by the freshly generated data in memory
+class CachedMesh {
+public:
+    CachedMesh() : mapping(nullptr), mappingSize(0) {
+        std::memset(&mappedView, 0, sizeof(mappedView));
+    }
+
+    ~CachedMesh() {
+        unmap();
+    }
+
+    CachedMesh(const CachedMesh&) = delete;
+    CachedMesh& operator=(const CachedMesh&) = delete;
+
+    // Maps the cached mesh for `key`, generating and writing it first on a miss.
+    // Returns true on a cache hit; after a miss, isMapped() tells whether the new file was written.
+    bool load(const MeshCacheKey& key, const std::string& cacheDir = "mesh_cache") {
+        unmap();
+        generated = IndexedMesh();
+
+        std::string path = meshCachePath(cacheDir, key);
+        if (map(path, key)) {
+            return true;
+        }
+
+        generate(key);
+
+        mkdir(cacheDir.c_str(), 0755);
+        if (writeMeshCache(path, key, makeMeshView(generated)) && map(path, key)) {
+            // Drop the generated copy; from now on the mapping is the only storage
+            generated = IndexedMesh();
+        }
+
+        return false;
+    }
+
+    bool isMapped() const {
+        return mapping != nullptr;
+    }
+
+    MeshView view() const {
+        return isMapped() ? mappedView : makeMeshView(generated);
+    }
+
+private:
+    void* mapping;
+    size_t mappingSize;
+    MeshView mappedView;
+    IndexedMesh generated;
+
+    bool map(const std::string& path, const MeshCacheKey& key) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(MeshCacheHeader)) {
+            close(fd);
+            return false;
+        }
+
+        void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // The mapping keeps its own reference to the file
+        if (data == MAP_FAILED) {
+            return false;
+        }
+
+        mapping = data;
+        mappingSize = info.st_size;
+
+        if (!validate(key)) {
+            unmap();
+            return false;
+        }
+
+        return true;
+    }
+
+    // Whether `count` elements at `offset` lie past the header, inside the file and aligned for their
+    // type; sizes are compared by division so a corrupt count cannot overflow
+    bool blockFits(uint64_t offset, uint64_t count, size_t elementSize, size_t alignment) const {
+        return offset >= sizeof(MeshCacheHeader) && offset <= mappingSize && offset % alignment == 0
+            && count <= (mappingSize - offset) / elementSize;
+    }
+
+    // Checks the header against the key, that every block fits in the file and
+    // that every index names a vertex; anything else is regenerated
+    bool validate(const MeshCacheKey& key) {
+        const MeshCacheHeader* header = static_cast<const MeshCacheHeader*>(mapping);
+        const char* bytes = static_cast<const char*>(mapping);
+
+        if (std::memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0
+            || header->version != MESH_CACHE_VERSION
+            || header->subdivisions != uint32_t(key.subdivisions)
+            || header->layout != uint32_t(key.layout)
+            || header->indexed != uint32_t(key.indexed)) {
+            return false;
+        }
+
+        bool wantsNormals = key.layout == MESH_LAYOUT_POSITIONS_NORMALS;
+        if ((header->normalsOffset != 0) != wantsNormals || (header->indexCount > 0) != key.indexed) {
+            return false;
+        }
+
+        if (header->vertexCount == 0 || !blockFits(header->positionsOffset, header->vertexCount, sizeof(Vec3), alignof(Vec3))) {
+            return false;
+        }
+        if (wantsNormals && !blockFits(header->normalsOffset, header->vertexCount, sizeof(glm::vec3), alignof(glm::vec3))) {
+            return false;
+        }
+        if (key.indexed) {
+            if (header->indexCount % 3 != 0 || !blockFits(header->indicesOffset, header->indexCount, sizeof(unsigned int), alignof(unsigned int))) {
+                return false;
+            }
+            const unsigned int* indices = reinterpret_cast<const unsigned int*>(bytes + header->indicesOffset);
+            for (uint64_t i = 0; i < header->indexCount; i++) {
+                if (indices[i] >= header->vertexCount)
+                    return false;
+            }
+        } else if (header->vertexCount % 3 != 0) {
+            return false;
+        }
+
+        mappedView.vertices = reinterpret_cast<const Vec3*>(bytes + header->positionsOffset);
+        mappedView.vertexCount = header->vertexCount;
+        mappedView.normals = wantsNormals ? reinterpret_cast<const glm::vec3*>(bytes + header->normalsOffset) : nullptr;
+        mappedView.indices = key.indexed ? reinterpret_cast<const unsigned int*>(bytes + header->indicesOffset) : nullptr;
+        mappedView.indexCount = header->indexCount;
+
+        return true;
+    }
+
+    void generate(const MeshCacheKey& key) {
+        NormalMode normalMode = key.layout == MESH_LAYOUT_POSITIONS_NORMALS ? NORMALS_EMIT : NORMALS_OMIT;
+
+        if (key.indexed) {
+            generated = createIndexedIcosphere(key.subdivisions, normalMode);
+            // Paid once per cache miss; every later start maps the optimized order
+            optimizeMesh(generated);
+        } else {
+            generated.vertices = createIcosphere(key.subdivisions);
+            if (normalMode == NORMALS_EMIT) {
+                generated.normals = normalsFromPositions(generated.vertices);
+            }
+        }
+    }
+
+    void unmap() {
+        if (mapping != nullptr) {
+            munmap(mapping, mappingSize);
+            mapping = nullptr;
+            mappingSize = 0;
+        }
+    }
+};
+
+#endif // MESHCACHE_H
@@ -0,0 +1,238 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "graphics.hpp"
+
+// Post-transform vertex cache and vertex fetch optimization for indexed meshes.
+// The triangle order follows Tom Forsyth's "Linear-Speed Vertex Cache
+// Optimisation": greedily emit the triangle whose vertices score highest, where
+// recently used vertices and vertices with few remaining triangles score more.
+
+struct VertexCacheStats {
+    float acmr; // Average cache miss ratio: transformed vertices per triangle (0.5 is ideal on large meshes)
+    float atvr; // Average transformed vertex ratio: transformed vertices per unique vertex (1.0 is ideal)
+};
+
+// Simulates a FIFO post-transform cache of `cacheSize` entries over the index stream
+inline VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16) {
+    std::vector<size_t> insertedAt(vertexCount, 0); // FIFO position at insertion, 0 = never cached
+    size_t misses = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        unsigned int v = indices[i];
+        // A vertex is still cached if fewer than cacheSize misses happened since it was inserted
+        if (insertedAt[v] == 0 || misses - insertedAt[v] >= cacheSize) {
+            misses++;
+            insertedAt[v] = misses;
+        }
+    }
+
+    VertexCacheStats stats;
+    stats.acmr = indexCount > 0 ? float(misses) / float(indexCount / 3) : 0.0f;
+    stats.atvr = vertexCount > 0 ? float(misses) / float(vertexCount) : 0.0f;
+
+    return stats;
+}
+
+inline VertexCacheStats analyzeVertexCache(const MeshView& mesh, unsigned int cacheSize = 16) {
+    return analyzeVertexCache(mesh.indices, mesh.indexCount, mesh.vertexCount, cacheSize);
+}
+
+const int FORSYTH_CACHE_SIZE = 32;
+
+const unsigned int FORSYTH_VALENCE_TABLE_SIZE = 32;
+
+struct ForsythScoreTables {
+    float cache[FORSYTH_CACHE_SIZE];
+    float valence[FORSYTH_VALENCE_TABLE_SIZE];
+
+    ForsythScoreTables() {
+        const float cacheDecayPower = 1.5f;
+        const float lastTriangleScore = 0.75f;
+
+        for (int i = 0; i < FORSYTH_CACHE_SIZE; i++) {
+            // Used by the last triangle: deliberately a little lower so the
+            // next triangle doesn't just reuse the same edge
+            if (i < 3)
+                cache[i] = lastTriangleScore;
+            else
+                cache[i] = std::pow(1.0f - float(i - 3) / (FORSYTH_CACHE_SIZE - 3), cacheDecayPower);
+        }
+
+        for (unsigned int i = 0; i < FORSYTH_VALENCE_TABLE_SIZE; i++)
+            valence[i] = valenceBoost(i);
+    }
+
+    // Boost vertices with few triangles left so they get finished off
+    static float valenceBoost(unsigned int remainingTriangles) {
+        const float valenceBoostScale = 2.0f;
+        const float valenceBoostPower = 0.5f;
+        return remainingTriangles == 0 ? 0.0f : valenceBoostScale * std::pow(float(remainingTriangles), -valenceBoostPower);
+    }
+};
+
+inline float forsythVertexScore(int cachePosition, unsigned int remainingTriangles) {
+    static const ForsythScoreTables tables;
+
+    if (remainingTriangles == 0) {
+        return -1.0f; // No triangles left to use this vertex
+    }
+
+    float score = cachePosition >= 0 ? tables.cache[cachePosition] : 0.0f;
+    score += remainingTriangles < FORSYTH_VALENCE_TABLE_SIZE ? tables.valence[remainingTriangles] : ForsythScoreTables::valenceBoost(remainingTriangles);
+
+    return score;
+}
+
+// Reorders triangles in place for post-transform cache reuse
+inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount) {
+    size_t triangleCount = indices.size() / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Vertex -> triangle adjacency in one flat array
+    std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+        adjacencyOffset[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+        adjacencyOffset[v + 1] += adjacencyOffset[v];
+
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++)
+        adjacency[fill[indices[i]]++] = i / 3;
+
+    std::vector<unsigned int> remaining(vertexCount);
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        remaining[v] = adjacencyOffset[v + 1] - adjacencyOffset[v];
+        vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<float> triangleScore(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+
+    std::vector<unsigned int> optimized;
+    optimized.reserve(indices.size());
+
+    // LRU cache, with room for the three vertices pushed before trimming
+    std::vector<unsigned int> cache;
+    cache.reserve(FORSYTH_CACHE_SIZE + 3);
+    std::vector<unsigned int> newCache;
+    newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+    // Recently used vertices, consulted when the cache runs dry so the next run
+    // starts near the last one instead of rescanning every triangle
+    std::vector<unsigned int> deadEnd;
+    deadEnd.reserve(indices.size());
+
+    size_t bestTriangle = 0;
+    size_t scanCursor = 0; // Triangles before this are all emitted
+
+    for (size_t step = 0; step < triangleCount; step++) {
+        while (bestTriangle == triangleCount && !deadEnd.empty()) {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; a++) {
+                if (bestTriangle == triangleCount || triangleScore[adjacency[a]] > triangleScore[bestTriangle])
+                    bestTriangle = adjacency[a];
+            }
+        }
+        if (bestTriangle == triangleCount) {
+            // Disconnected from everything emitted so far: continue in input order
+            while (emitted[scanCursor])
+                scanCursor++;
+            bestTriangle = scanCursor;
+        }
+
+        const unsigned int* triangle = &indices[3 * bestTriangle];
+        optimized.insert(optimized.end(), triangle, triangle + 3);
+        deadEnd.insert(deadEnd.end(), triangle, triangle + 3);
+        emitted[bestTriangle] = true;
+
+        // Move the triangle's vertices to the front of the cache and retire the triangle
+        newCache.assign(triangle, triangle + 3);
+        for (unsigned int v : cache) {
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache.push_back(v);
+        }
+        for (int k = 0; k < 3; k++) {
+            unsigned int v = triangle[k];
+            unsigned int* begin = &adjacency[adjacencyOffset[v]];
+            unsigned int* end = begin + remaining[v];
+            std::swap(*std::find(begin, end, (unsigned int)bestTriangle), *(end - 1));
+            remaining[v]--;
+        }
+
+        // Every vertex in the cache or just pushed out of it has a new score
+        for (size_t i = 0; i < newCache.size(); i++) {
+            int position = i < size_t(FORSYTH_CACHE_SIZE) ? int(i) : -1;
+            cachePosition[newCache[i]] = position;
+            vertexScore[newCache[i]] = forsythVertexScore(position, remaining[newCache[i]]);
+        }
+
+        // Only triangles touching those vertices changed score; the best one still in the cache goes next
+        bestTriangle = triangleCount;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < newCache.size(); i++) {
+            unsigned int v = newCache[i];
+            for (unsigned int a = adjacencyOffset[v]; a < adjacencyOffset[v] + remaining[v]; a++) {
+                unsigned int t = adjacency[a];
+                float score = vertexScore[indices[3 * t]] + vertexScore[indices[3 * t + 1]] + vertexScore[indices[3 * t + 2]];
+                triangleScore[t] = score;
+                if (i < size_t(FORSYTH_CACHE_SIZE) && score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        if (newCache.size() > size_t(FORSYTH_CACHE_SIZE))
+            newCache.resize(FORSYTH_CACHE_SIZE);
+        cache.swap(newCache);
+    }
+
+    indices.swap(optimized);
+}
+
+// Renumbers vertices in order of first use so vertex fetches walk memory linearly
+inline void optimizeVertexFetch(IndexedMesh& mesh) {
+    const unsigned int unassigned = ~0u;
+    std::vector<unsigned int> remap(mesh.vertices.size(), unassigned);
+    std::vector<Vec3> vertices;
+    std::vector<glm::vec3> normals;
+    vertices.reserve(mesh.vertices.size());
+    normals.reserve(mesh.normals.size());
+
+    for (unsigned int& index : mesh.indices) {
+        if (remap[index] == unassigned) {
+            remap[index] = vertices.size();
+            vertices.push_back(mesh.vertices[index]);
+            if (!mesh.normals.empty())
+                normals.push_back(mesh.normals[index]);
+        }
+        index = remap[index];
+    }
+
+    // Unreferenced vertices are dropped
+    mesh.vertices.swap(vertices);
+    mesh.normals.swap(normals);
+}
+
+// Full pass: triangle order for the post-transform cache, then vertex order for fetch locality
+inline void optimizeMesh(IndexedMesh& mesh) {
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeVertexFetch(mesh);
+}
+
+#endif // MESHOPTIMIZER_H
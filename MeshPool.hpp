@@ -0,0 +1,171 @@
+#ifndef MESHPOOL_H
+#define MESHPOOL_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include "graphics.hpp"
+#include "GLState.hpp"
+
+// Where a mesh lives inside a pool's (or an object's own) vertex and index buffers
+struct MeshHandle {
+    GLint baseVertex;   // First vertex of the mesh; its indices are relative to it
+    GLsizei vertexCount;
+    GLsizei firstIndex; // First index of the mesh in the EBO
+    GLsizei indexCount; // 0 for non-indexed meshes
+};
+
+// Suballocates many meshes out of one VBO and one EBO behind a single VAO, so
+// switching meshes is just a different (baseVertex, firstIndex, count) and
+// heterogeneous meshes can go into one multi-draw. All meshes share the pool's
+// vertex format. The buffers double in size when full, copied on the GPU.
+class MeshPool {
+public:
+    explicit MeshPool(VertexFormat format = VERTEX_FORMAT_FLOAT, size_t vertexCapacity = 1 << 16, size_t indexCapacity = 1 << 18)
+        : VAO(0), VBO(0), EBO(0), format(format), vertexCapacity(0), indexCapacity(0), vertexCount(0), indexCount(0) {
+        reserve(vertexCapacity, indexCapacity);
+    }
+
+    ~MeshPool() {
+        glState().deleteVertexArrays(1, &VAO);
+        glState().deleteBuffers(1, &VBO);
+        glState().deleteBuffers(1, &EBO);
+    }
+
+    MeshPool(const MeshPool&) = delete;
+    MeshPool& operator=(const MeshPool&) = delete;
+
+    // Copies the mesh into the pool, encoded in the pool's format. Non-indexed meshes get a 0..n-1 index range.
+    MeshHandle add(const MeshView& mesh) {
+        size_t meshIndexCount = mesh.indices != nullptr ? mesh.indexCount : mesh.vertexCount;
+        reserve(vertexCount + mesh.vertexCount, indexCount + meshIndexCount);
+
+        MeshHandle handle;
+        handle.baseVertex = vertexCount;
+        handle.vertexCount = mesh.vertexCount;
+        handle.firstIndex = indexCount;
+        handle.indexCount = meshIndexCount;
+
+        size_t stride = vertexFormatStride(format);
+        glState().bindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        if (format == VERTEX_FORMAT_FLOAT) {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * stride, mesh.vertexCount * stride, mesh.vertices);
+        } else if (format == VERTEX_FORMAT_FLOAT_NORMAL) {
+            std::vector<FloatNormalVertex> vertices = interleaveVertices(mesh);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * stride, vertices.size() * stride, vertices.data());
+        } else if (format == VERTEX_FORMAT_PACKED) {
+            std::vector<PackedVertex> vertices = packVertices(mesh);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * stride, vertices.size() * stride, vertices.data());
+        } else {
+            std::vector<OctahedralVertex> vertices = packOctahedralVertices(mesh);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, vertexCount * stride, vertices.size() * stride, vertices.data());
+        }
+
+        glState().bindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        if (mesh.indices != nullptr) {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int), meshIndexCount * sizeof(unsigned int), mesh.indices);
+        } else {
+            std::vector<unsigned int> sequential(meshIndexCount);
+            for (size_t i = 0; i < meshIndexCount; i++)
+                sequential[i] = i;
+            glBufferSubData(GL_COPY_WRITE_BUFFER, indexCount * sizeof(unsigned int), meshIndexCount * sizeof(unsigned int), sequential.data());
+        }
+
+        vertexCount += mesh.vertexCount;
+        indexCount += meshIndexCount;
+
+        return handle;
+    }
+
+    // Grows the buffers (keeping their contents) to hold at least this much
+    void reserve(size_t vertices, size_t indices) {
+        if (vertices <= vertexCapacity && indices <= indexCapacity && VAO != 0) {
+            return;
+        }
+
+        if (vertices > vertexCapacity) {
+            size_t capacity = std::max(vertices, vertexCapacity * 2);
+            size_t stride = vertexFormatStride(format);
+            VBO = growBuffer(VBO, vertexCount * stride, capacity * stride);
+            vertexCapacity = capacity;
+        }
+        if (indices > indexCapacity) {
+            size_t capacity = std::max(indices, indexCapacity * 2);
+            EBO = growBuffer(EBO, indexCount * sizeof(unsigned int), capacity * sizeof(unsigned int));
+            indexCapacity = capacity;
+        }
+
+        // The attribute pointers and element binding name the old buffers; rebuild the VAO around the new ones
+        glState().deleteVertexArrays(1, &VAO);
+        VAO = createVAO(VBO, format);
+        if (format != VERTEX_FORMAT_FLOAT)
+            bindNormalsToVAO(VAO, VBO, 1, format);
+        glState().bindVertexArray(VAO);
+        glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glState().bindVertexArray(0);
+    }
+
+    // Binds the shared VAO; every mesh in the pool can then be drawn without rebinding
+    void bind() const {
+        glState().bindVertexArray(VAO);
+    }
+
+    // Draws one mesh; the pool must be bound
+    void draw(const MeshHandle& handle) const {
+        glDrawElementsBaseVertex(GL_TRIANGLES, handle.indexCount, GL_UNSIGNED_INT, (void*)(handle.firstIndex * sizeof(unsigned int)), handle.baseVertex);
+    }
+
+    GLuint getVAO() const {
+        return VAO;
+    }
+
+    GLuint getVertexBuffer() const {
+        return VBO;
+    }
+
+    GLuint getIndexBuffer() const {
+        return EBO;
+    }
+
+    VertexFormat getVertexFormat() const {
+        return format;
+    }
+
+    size_t getVertexCount() const {
+        return vertexCount;
+    }
+
+    size_t getIndexCount() const {
+        return indexCount;
+    }
+
+private:
+    GLuint VAO, VBO, EBO;
+    VertexFormat format;
+    size_t vertexCapacity;
+    size_t indexCapacity;
+    size_t vertexCount; // In use, from the start of the buffers
+    size_t indexCount;
+
+    // The copy targets leave GL_ARRAY_BUFFER and any VAO's element binding alone
+    static GLuint growBuffer(GLuint old, size_t usedBytes, size_t newBytes) {
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glState().bindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newBytes, nullptr, GL_STATIC_DRAW);
+
+        if (old != 0) {
+            if (usedBytes > 0) {
+                glState().bindBuffer(GL_COPY_READ_BUFFER, old);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedBytes);
+            }
+            glState().deleteBuffers(1, &old);
+        }
+
+        return buffer;
+    }
+};
+
+#endif // MESHPOOL_H
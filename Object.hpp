@@ -6,49 +6,272 @@
 #include <glm/vec3.hpp> // for glm::vec3
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <utility>
 #include <vector>
 #include "graphics.hpp"
+#include "GLState.hpp"
+#include "MeshPool.hpp"
+#include "Frustum.hpp"
+
+// Approximate on-screen radius in pixels of a sphere, measured from its nearest point
+inline float projectedSphereRadius(const glm::vec3& center, float radius, const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight) {
+    // projection[1][1] is cot(fov / 2), so this is the pixel size of one radian at unit distance
+    float pixelsPerRadian = projection[1][1] * viewportHeight / 2.0f;
+    float distance = std::max(glm::length(cameraPosition - center) - radius, 1e-6f);
+    return radius * pixelsPerRadian / distance;
+}
+
+// One detail level inside the object's own buffers or its mesh pool
+struct LodLevel : MeshHandle {
+    float error; // Largest gap between the triangles and the bounding sphere, relative to its radius
+};
 
 class RenderableObject {
 public:
     RenderableObject(std::vector<Vec3> v, std::vector<glm::vec3> n);
+    RenderableObject(std::vector<Vec3> v, std::vector<unsigned int> i, std::vector<glm::vec3> n);
+    RenderableObject(std::vector<Vec3> v, std::vector<unsigned int> i); // Unit sphere, normals derived in the shader
+    explicit RenderableObject(const MeshView& mesh, VertexFormat format = VERTEX_FORMAT_FLOAT); // Uploads from the view, no CPU-side copy is kept
+    explicit RenderableObject(const std::vector<MeshView>& lods, VertexFormat format = VERTEX_FORMAT_FLOAT); // LOD chain, finest level first
+    RenderableObject(MeshPool& pool, const std::vector<MeshView>& lods); // LOD chain stored in the pool, which must outlive the object
     ~RenderableObject();
 
-    void initialize(); // Set up VAO, VBO, etc.
-    void render(const GLuint& shaderProgram); // Render the object
+    // Owns its GL objects, so it can be moved but not copied
+    RenderableObject(const RenderableObject&) = delete;
+    RenderableObject& operator=(const RenderableObject&) = delete;
+    RenderableObject(RenderableObject&& other) noexcept;
+    RenderableObject& operator=(RenderableObject&& other) noexcept;
+
+    void initialize(const MeshView& mesh, VertexFormat format = VERTEX_FORMAT_FLOAT); // Set up VAO, VBO, etc.
+    void initialize(const std::vector<MeshView>& lods, VertexFormat format = VERTEX_FORMAT_FLOAT); // All levels go into one VBO/EBO pair
+    void replaceMesh(const MeshView& mesh); // Re-uploads into the existing buffers when the layout matches, else re-initializes
+    void render(const GLuint& shaderProgram); // Render the selected level
+    // One instanced draw of `level` for instanceCount entries of instanceVBO, starting at firstInstance
+    void renderInstanced(size_t level, GLuint instanceVBO, size_t firstInstance, GLsizei instanceCount);
     void setPosition(const glm::vec3& position);
     void setRotation(const glm::vec3& axis, float angle);
     void setScale(const glm::vec3& scale);
 
+    // Picks the coarsest level whose error projects to at most `pixelError` pixels from the camera
+    size_t selectLod(const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError = 1.0f);
+    // Same choice for a copy of this mesh centred at `center` and uniformly scaled by `scale`
+    size_t lodFor(const glm::vec3& center, float scale, const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError = 1.0f) const;
+    void setLod(size_t level);
+    size_t getLod() const;
+    size_t getLodCount() const;
+    const LodLevel& getLodLevel(size_t level) const;
+
     glm::mat4 getModelMatrix() const;
+    bool inFrustum(const Frustum& frustum) const; // Bounding sphere test at the current position and scale
+    bool hasNormals() const;
+    VertexFormat getVertexFormat() const;
+    MeshPool* getPool() const; // nullptr when the object owns its buffers
 
 private:
-    GLuint VAO, VBO; // Vertex Array Object, Vertex Buffer Object
+    GLuint VAO, VBO, EBO; // Owned; 0 when absent, moved from or pooled
+    MeshPool* pool;
     glm::mat4 modelMatrix;
-    std::vector<Vec3> vertices; // Vertex data
-    std::vector<glm::vec3> normals; // Normal data
+    glm::vec3 position;
+    glm::mat4 rotation;
+    glm::vec3 scale;
+    VertexFormat vertexFormat; // Encoding of the data in VBO
+    std::vector<LodLevel> levels;
+    size_t activeLod;
+    float boundingRadius; // Object space, around the origin
 
     void updateModelMatrix(); // Recalculate the model matrix if transformations change
-    // Other private methods and properties as needed
+    void release(); // Delete the GL objects and zero the handles
+    GLuint vertexArray() const; // The VAO to draw with, own or pooled
+    static float boundingSphereRadius(const std::vector<MeshView>& lods);
+    static float sphereError(const MeshView& mesh, float radius);
 };
-RenderableObject::RenderableObject(std::vector<Vec3> v, std::vector<glm::vec3> n) : vertices(v), normals(n), VAO(0), VBO(0) {
-    initialize();
+RenderableObject::RenderableObject(std::vector<Vec3> v, std::vector<glm::vec3> n) : VAO(0), VBO(0), EBO(0), pool(nullptr), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(VERTEX_FORMAT_FLOAT), activeLod(0), boundingRadius(0.0f) {
+    initialize(makeMeshView(v, std::vector<unsigned int>(), n));
+}
+
+RenderableObject::RenderableObject(std::vector<Vec3> v, std::vector<unsigned int> i, std::vector<glm::vec3> n) : VAO(0), VBO(0), EBO(0), pool(nullptr), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(VERTEX_FORMAT_FLOAT), activeLod(0), boundingRadius(0.0f) {
+    initialize(makeMeshView(v, i, n));
+}
+
+RenderableObject::RenderableObject(std::vector<Vec3> v, std::vector<unsigned int> i) : VAO(0), VBO(0), EBO(0), pool(nullptr), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(VERTEX_FORMAT_FLOAT), activeLod(0), boundingRadius(0.0f) {
+    initialize(makeMeshView(v, i, std::vector<glm::vec3>()));
+}
+
+RenderableObject::RenderableObject(const MeshView& mesh, VertexFormat format) : VAO(0), VBO(0), EBO(0), pool(nullptr), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(VERTEX_FORMAT_FLOAT), activeLod(0), boundingRadius(0.0f) {
+    initialize(mesh, format);
+}
+
+RenderableObject::RenderableObject(const std::vector<MeshView>& lods, VertexFormat format) : VAO(0), VBO(0), EBO(0), pool(nullptr), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(VERTEX_FORMAT_FLOAT), activeLod(0), boundingRadius(0.0f) {
+    initialize(lods, format);
+}
+
+RenderableObject::RenderableObject(MeshPool& pool, const std::vector<MeshView>& lods) : VAO(0), VBO(0), EBO(0), pool(&pool), modelMatrix(1.0f), position(0.0f), rotation(1.0f), scale(1.0f),
+      vertexFormat(pool.getVertexFormat()), activeLod(0), boundingRadius(boundingSphereRadius(lods)) {
+    for (const MeshView& mesh : lods) {
+        LodLevel level;
+        static_cast<MeshHandle&>(level) = pool.add(mesh);
+        level.error = sphereError(mesh, boundingRadius);
+        levels.push_back(level);
+    }
 }
 
 RenderableObject::~RenderableObject() {
-    // Clean up resources
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    release();
+}
+
+RenderableObject::RenderableObject(RenderableObject&& other) noexcept
+    : VAO(other.VAO), VBO(other.VBO), EBO(other.EBO), pool(other.pool), modelMatrix(other.modelMatrix), position(other.position),
+      rotation(other.rotation), scale(other.scale), vertexFormat(other.vertexFormat), levels(std::move(other.levels)),
+      activeLod(other.activeLod), boundingRadius(other.boundingRadius) {
+    other.VAO = other.VBO = other.EBO = 0;
+    other.levels.clear();
+    other.activeLod = 0;
 }
 
-void RenderableObject::initialize() {
+RenderableObject& RenderableObject::operator=(RenderableObject&& other) noexcept {
+    if (this != &other) {
+        release();
+        VAO = other.VAO;
+        VBO = other.VBO;
+        EBO = other.EBO;
+        pool = other.pool;
+        modelMatrix = other.modelMatrix;
+        position = other.position;
+        rotation = other.rotation;
+        scale = other.scale;
+        vertexFormat = other.vertexFormat;
+        levels = std::move(other.levels);
+        activeLod = other.activeLod;
+        boundingRadius = other.boundingRadius;
+
+        other.VAO = other.VBO = other.EBO = 0;
+        other.levels.clear();
+        other.activeLod = 0;
+    }
+    return *this;
+}
+
+void RenderableObject::release() {
+    // Deleting 0 is a no-op, so moved-from objects are safe
+    glState().deleteVertexArrays(1, &VAO);
+    glState().deleteBuffers(1, &VBO);
+    glState().deleteBuffers(1, &EBO);
+    VAO = VBO = EBO = 0;
+}
+
+void RenderableObject::initialize(const MeshView& mesh, VertexFormat format) {
+    initialize(std::vector<MeshView>(1, mesh), format);
+}
+
+void RenderableObject::initialize(const std::vector<MeshView>& lods, VertexFormat format) {
     // Generate and bind VAO and VBO, upload vertex data, etc.
     GLuint normalAttributeIndex = 1;
 
-    VBO = createVBO(vertices);
-    VAO = createVAO(VBO);
-    GLuint normalVbo = createNormalsVBO(normals);
-    bindNormalsToVAO(VAO, normalVbo, normalAttributeIndex);
+    release();
+    pool = nullptr;
+    levels.clear();
+    activeLod = 0;
+    boundingRadius = boundingSphereRadius(lods);
+
+    // Normals always share the position buffer; float meshes with normals are interleaved
+    bool withNormals = !lods.empty();
+    for (const MeshView& mesh : lods)
+        withNormals = withNormals && mesh.normals != nullptr;
+    if (format == VERTEX_FORMAT_FLOAT && withNormals)
+        format = VERTEX_FORMAT_FLOAT_NORMAL;
+    vertexFormat = format;
+
+    // Levels are appended back to back; indices stay level-relative and are offset by baseVertex when drawn
+    std::vector<Vec3> positions;
+    std::vector<FloatNormalVertex> interleaved;
+    std::vector<PackedVertex> packed;
+    std::vector<OctahedralVertex> octahedral;
+    std::vector<unsigned int> indices;
+    size_t totalVertices = 0;
+    // A single level is uploaded straight from its view without staging copies where the format allows
+    bool staged = lods.size() > 1;
+
+    for (const MeshView& mesh : lods) {
+        LodLevel level;
+        level.baseVertex = totalVertices;
+        level.vertexCount = mesh.vertexCount;
+        level.firstIndex = indices.size();
+        level.indexCount = mesh.indices != nullptr ? mesh.indexCount : 0;
+        level.error = sphereError(mesh, boundingRadius);
+        levels.push_back(level);
+        totalVertices += mesh.vertexCount;
+
+        if (format == VERTEX_FORMAT_FLOAT) {
+            if (staged)
+                positions.insert(positions.end(), mesh.vertices, mesh.vertices + mesh.vertexCount);
+        } else if (format == VERTEX_FORMAT_FLOAT_NORMAL) {
+            std::vector<FloatNormalVertex> levelVertices = interleaveVertices(mesh);
+            interleaved.insert(interleaved.end(), levelVertices.begin(), levelVertices.end());
+        } else if (format == VERTEX_FORMAT_PACKED) {
+            std::vector<PackedVertex> levelVertices = packVertices(mesh);
+            packed.insert(packed.end(), levelVertices.begin(), levelVertices.end());
+        } else {
+            std::vector<OctahedralVertex> levelVertices = packOctahedralVertices(mesh);
+            octahedral.insert(octahedral.end(), levelVertices.begin(), levelVertices.end());
+        }
+        if (staged && level.indexCount > 0)
+            indices.insert(indices.end(), mesh.indices, mesh.indices + level.indexCount);
+    }
+
+    if (format == VERTEX_FORMAT_FLOAT)
+        VBO = staged ? createVBO(positions) : createVBO(lods[0].vertices, lods[0].vertexCount);
+    else if (format == VERTEX_FORMAT_FLOAT_NORMAL)
+        VBO = createVBO(interleaved);
+    else if (format == VERTEX_FORMAT_PACKED)
+        VBO = createVBO(packed);
+    else
+        VBO = createVBO(octahedral);
+
+    VAO = createVAO(VBO, format);
+    // Every format but plain positions carries the normal in the same VBO
+    if (format != VERTEX_FORMAT_FLOAT)
+        bindNormalsToVAO(VAO, VBO, normalAttributeIndex, format);
+
+    if (!levels.empty() && (staged ? !indices.empty() : levels[0].indexCount > 0)) {
+        // The element buffer binding is VAO state, so create it while the VAO is bound
+        glState().bindVertexArray(VAO);
+        EBO = staged ? createEBO(indices) : createEBO(lods[0].indices, levels[0].indexCount);
+        glState().bindVertexArray(0);
+    }
+}
+
+void RenderableObject::replaceMesh(const MeshView& mesh) {
+    bool sameLayout = pool == nullptr && VAO != 0 && levels.size() == 1 && vertexFormat == VERTEX_FORMAT_FLOAT &&
+                      mesh.normals == nullptr && (mesh.indices != nullptr && mesh.indexCount > 0) == (EBO != 0);
+    if (!sameLayout) {
+        initialize(mesh, vertexFormat == VERTEX_FORMAT_FLOAT_NORMAL ? VERTEX_FORMAT_FLOAT : vertexFormat);
+        return;
+    }
+
+    boundingRadius = boundingSphereRadius(std::vector<MeshView>(1, mesh));
+    LodLevel& level = levels[0];
+    level.vertexCount = mesh.vertexCount;
+    level.indexCount = EBO != 0 ? mesh.indexCount : 0;
+    level.error = sphereError(mesh, boundingRadius);
+    activeLod = 0;
+
+    // Respecifying the storage orphans the old contents, so a frame still drawing from them does not stall
+    glState().bindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertexCount * sizeof(Vec3), mesh.vertices, GL_STATIC_DRAW);
+    if (EBO != 0) {
+        // The element buffer binding is VAO state
+        glState().bindVertexArray(VAO);
+        glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indexCount * sizeof(unsigned int), mesh.indices, GL_STATIC_DRAW);
+        glState().bindVertexArray(0);
+    }
 }
 
 void RenderableObject::render(const GLuint& shaderProgram) {
@@ -58,31 +281,144 @@ void RenderableObject::render(const GLuint& shaderProgram) {
     //GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
     //glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(getModelMatrix()));
 
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
-    glBindVertexArray(0);
+    if (levels.empty()) {
+        return;
+    }
+    const LodLevel& level = levels[activeLod];
+
+    glState().bindVertexArray(vertexArray());
+    if (level.indexCount > 0)
+        glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT, (void*)(level.firstIndex * sizeof(unsigned int)), level.baseVertex);
+    else
+        glDrawArrays(GL_TRIANGLES, level.baseVertex, level.vertexCount);
+}
+
+void RenderableObject::renderInstanced(size_t level, GLuint instanceVBO, size_t firstInstance, GLsizei instanceCount) {
+    if (level >= levels.size() || instanceCount <= 0) {
+        return;
+    }
+    const LodLevel& lod = levels[level];
+
+    // Instance attributes follow the mesh attributes (0: position, 1: normal)
+    bindInstancesToVAO(vertexArray(), instanceVBO, 2, firstInstance);
+
+    glState().bindVertexArray(vertexArray());
+    if (lod.indexCount > 0)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, GL_UNSIGNED_INT, (void*)(lod.firstIndex * sizeof(unsigned int)), instanceCount, lod.baseVertex);
+    else
+        glDrawArraysInstanced(GL_TRIANGLES, lod.baseVertex, lod.vertexCount, instanceCount);
 }
 
 void RenderableObject::setPosition(const glm::vec3& position) {
-    modelMatrix = glm::translate(glm::mat4(1.0f), position);
+    this->position = position;
     updateModelMatrix();
 }
 
 void RenderableObject::setRotation(const glm::vec3& axis, float angle) {
-    modelMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(angle), axis);
+    rotation = glm::rotate(glm::mat4(1.0f), glm::radians(angle), axis);
     updateModelMatrix();
 }
 
 void RenderableObject::setScale(const glm::vec3& scale) {
-    modelMatrix = glm::scale(glm::mat4(1.0f), scale);
+    this->scale = scale;
     updateModelMatrix();
 }
 
+size_t RenderableObject::selectLod(const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError) {
+    float maxScale = std::max(std::fabs(scale.x), std::max(std::fabs(scale.y), std::fabs(scale.z)));
+    activeLod = lodFor(position, maxScale, cameraPosition, projection, viewportHeight, pixelError);
+    return activeLod;
+}
+
+size_t RenderableObject::lodFor(const glm::vec3& center, float scale, const glm::vec3& cameraPosition, const glm::mat4& projection, float viewportHeight, float pixelError) const {
+    if (levels.size() < 2) {
+        return 0;
+    }
+
+    float projectedRadius = projectedSphereRadius(center, boundingRadius * scale, cameraPosition, projection, viewportHeight);
+
+    for (size_t i = levels.size(); i-- > 0;) {
+        if (levels[i].error * projectedRadius <= pixelError)
+            return i;
+    }
+
+    return 0;
+}
+
+void RenderableObject::setLod(size_t level) {
+    activeLod = std::min(level, levels.empty() ? 0 : levels.size() - 1);
+}
+
+size_t RenderableObject::getLod() const {
+    return activeLod;
+}
+
+size_t RenderableObject::getLodCount() const {
+    return levels.size();
+}
+
+const LodLevel& RenderableObject::getLodLevel(size_t level) const {
+    return levels[level];
+}
+
 glm::mat4 RenderableObject::getModelMatrix() const {
     return modelMatrix;
 }
 
+bool RenderableObject::inFrustum(const Frustum& frustum) const {
+    float maxScale = std::max(std::fabs(scale.x), std::max(std::fabs(scale.y), std::fabs(scale.z)));
+    return frustum.containsSphere(position, boundingRadius * maxScale);
+}
+
+bool RenderableObject::hasNormals() const {
+    return vertexFormat != VERTEX_FORMAT_FLOAT;
+}
+
+VertexFormat RenderableObject::getVertexFormat() const {
+    return vertexFormat;
+}
+
+MeshPool* RenderableObject::getPool() const {
+    return pool;
+}
+
+GLuint RenderableObject::vertexArray() const {
+    return pool != nullptr ? pool->getVAO() : VAO;
+}
+
 void RenderableObject::updateModelMatrix() {
     // Recalculate modelMatrix based on position, rotation, and scale
+    modelMatrix = glm::translate(glm::mat4(1.0f), position) * rotation * glm::scale(glm::mat4(1.0f), scale);
+}
+
+float RenderableObject::boundingSphereRadius(const std::vector<MeshView>& lods) {
+    float radius = 0.0f;
+    for (const MeshView& mesh : lods) {
+        for (size_t i = 0; i < mesh.vertexCount; i++) {
+            const Vec3& v = mesh.vertices[i];
+            radius = std::max(radius, std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z));
+        }
+    }
+    return radius;
+}
+
+// Every triangle's centroid is its deepest point below the sphere through the vertices, to within a few percent
+float RenderableObject::sphereError(const MeshView& mesh, float radius) {
+    if (radius <= 0.0f) {
+        return 0.0f;
+    }
+
+    size_t cornerCount = mesh.indices != nullptr ? mesh.indexCount : mesh.vertexCount;
+    float minCentroidLength = radius;
+    for (size_t i = 0; i + 2 < cornerCount; i += 3) {
+        glm::vec3 centroid(0.0f);
+        for (size_t k = 0; k < 3; k++) {
+            const Vec3& v = mesh.vertices[mesh.indices != nullptr ? mesh.indices[i + k] : i + k];
+            centroid += glm::vec3(v.x, v.y, v.z);
+        }
+        minCentroidLength = std::min(minCentroidLength, glm::length(centroid / 3.0f));
+    }
+
+    return 1.0f - minCentroidLength / radius;
 }
 #endif // OBJECT_H
\ No newline at end of file
@@ -0,0 +1,514 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "graphics.hpp"
+#include "GLState.hpp"
+#include "DrawBatch.hpp"
+
+// Compute shaders, image stores and glTexStorage2D
+inline bool hiZCullingSupported() {
+    return GLEW_VERSION_4_3;
+}
+
+// GPU visibility tests for the second pass of two-pass occlusion culling:
+// whatever was visible last frame is drawn first, then everything else is
+// tested against the depth that pass left behind and only survivors are drawn.
+//
+// With GL 4.3 the depth buffer is reduced to a max-depth mip pyramid and a
+// compute shader tests each sphere against the few texels covering its screen
+// rectangle, appending survivors to a buffer and counting them into indirect
+// draw commands, so nothing comes back to the CPU in time for the draw.
+// On GL 3.3 each group's bounding box is drawn invisibly inside an occlusion
+// query and the group is drawn under conditional rendering on that query.
+// Both also report which objects were visible, a frame or two later, so the
+// caller can pick the next frame's first pass.
+class OcclusionCuller {
+public:
+    static const int MAX_BUCKETS = 16; // Mesh levels plus the impostors, per testSpheres() call
+    static const int FRAME_COUNT = 3; // Visibility results in flight
+
+    OcclusionCuller()
+        : hiZ(hiZCullingSupported()), proxyVAO(0), depthTexture(0), pyramidTexture(0), viewportWidth(0), viewportHeight(0),
+          pyramidWidth(0), pyramidHeight(0), pyramidLevels(0), downsampleProgram(0), cullProgram(0), survivorBuffer(0), survivorCapacity(0), commandBuffer(0),
+          visibilityWords(0), visibilityFrame(0) {
+        std::fill_n(visibilityBuffers, FRAME_COUNT, 0);
+        std::fill_n(visibilityFences, FRAME_COUNT, nullptr);
+
+        proxyProgram = createShaderProgram(createShader(GL_VERTEX_SHADER, proxyVertexSource), createShader(GL_FRAGMENT_SHADER, proxyFragmentSource));
+        proxyViewProjectionLoc = glGetUniformLocation(proxyProgram, "viewProjection");
+        proxyBoxMinLoc = glGetUniformLocation(proxyProgram, "boxMin");
+        proxyBoxMaxLoc = glGetUniformLocation(proxyProgram, "boxMax");
+        glGenVertexArrays(1, &proxyVAO); // Core profile draws need one, even with no attributes
+    }
+
+    ~OcclusionCuller() {
+        setQueryCount(0);
+        releaseVisibility();
+        glState().deleteVertexArrays(1, &proxyVAO);
+        glState().deleteProgram(proxyProgram);
+        glState().deleteTextures(1, &depthTexture);
+        glState().deleteTextures(1, &pyramidTexture);
+        glState().deleteBuffers(1, &survivorBuffer);
+        glState().deleteBuffers(1, &commandBuffer);
+        if (downsampleProgram != 0)
+            glState().deleteProgram(downsampleProgram);
+        if (cullProgram != 0)
+            glState().deleteProgram(cullProgram);
+    }
+
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    // Falls back to occlusion queries even where the pyramid is available, e.g. to compare the two
+    void setHiZ(bool enabled) {
+        hiZ = enabled && hiZCullingSupported();
+    }
+
+    bool usesHiZ() const {
+        return hiZ;
+    }
+
+    // Occlusion queries, one per group the caller tests; resizing drops every pending result
+    void setQueryCount(size_t count) {
+        if (!queries.empty())
+            glDeleteQueries(GLsizei(queries.size()), queries.data());
+        queries.assign(count, 0);
+        pending.assign(count, 0);
+        if (count > 0)
+            glGenQueries(GLsizei(count), queries.data());
+    }
+
+    size_t getQueryCount() const {
+        return queries.size();
+    }
+
+    // Draws between beginQueries() and endQueries() write neither color nor depth
+    void beginQueries(const glm::mat4& viewProjection) {
+        glState().useProgram(proxyProgram);
+        glUniformMatrix4fv(proxyViewProjectionLoc, 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glState().bindVertexArray(proxyVAO);
+        glState().colorMask(GL_FALSE);
+        glState().depthMask(GL_FALSE);
+    }
+
+    // The box must lie entirely in front of the near plane, or the query can miss a visible group
+    void queryBox(size_t index, const glm::vec3& min, const glm::vec3& max) {
+        glUniform3fv(proxyBoxMinLoc, 1, glm::value_ptr(min));
+        glUniform3fv(proxyBoxMaxLoc, 1, glm::value_ptr(max));
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[index]);
+        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        pending[index] = 1;
+    }
+
+    void endQueries() {
+        glState().colorMask(GL_TRUE);
+        glState().depthMask(GL_TRUE);
+    }
+
+    // Issued but not read back by pollQuery() yet
+    bool isPending(size_t index) const {
+        return pending[index] != 0;
+    }
+
+    // True once the last queryBox(index) has a result, which is stored in `visible`; never waits
+    bool pollQuery(size_t index, bool& visible) {
+        if (!pending[index]) {
+            return false;
+        }
+
+        GLuint available = 0;
+        glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return false;
+        }
+
+        GLuint samples = 0;
+        glGetQueryObjectuiv(queries[index], GL_QUERY_RESULT, &samples);
+        visible = samples != 0;
+        pending[index] = 0;
+        return true;
+    }
+
+    // Draws until endConditionalRender() are skipped by the GPU if the box of queryBox(index) was hidden.
+    // The GPU waits for the query; the CPU never does
+    void beginConditionalRender(size_t index) {
+        glBeginConditionalRender(queries[index], GL_QUERY_WAIT);
+    }
+
+    void endConditionalRender() {
+        glEndConditionalRender();
+    }
+
+    // Copies the default framebuffer's depth and reduces it to the pyramid. Level 0 is the largest
+    // power of two that fits the viewport, each texel the farthest depth of all pixels it overlaps
+    void buildPyramid(int width, int height) {
+        allocatePyramid(width, height);
+
+        glState().bindTexture(0, GL_TEXTURE_2D, depthTexture);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+        glState().useProgram(downsampleProgram);
+        for (int level = 0; level < pyramidLevels; level++) {
+            glState().bindTexture(0, GL_TEXTURE_2D, level == 0 ? depthTexture : pyramidTexture);
+            glUniform1i(downsampleSourceLevelLoc, std::max(level - 1, 0));
+            glBindImageTexture(0, pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+            int levelWidth = std::max(pyramidWidth >> level, 1);
+            int levelHeight = std::max(pyramidHeight >> level, 1);
+            glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+    }
+
+    // Tests `count` SphereInstances at byte `instanceOffset` of `buffer`, whose object ids (uint32) are at
+    // `idOffset`, against the pyramid; both offsets must be multiples of storageOffsetAlignment().
+    // Candidates from `revealedFirst` on were not drawn yet and are grouped by bucket: mesh levels first,
+    // then impostors, bucket b starting `bucketStart[b]` after revealedFirst. The visible ones among them
+    // are copied to getSurvivorBuffer() and counted into getCommandBuffer(): a DrawElementsIndirectCommand
+    // per level, then a DrawArraysIndirectCommand for the impostors. Every candidate's visibility, indexed
+    // by object id below objectCount, is recorded for readVisibility().
+    void testSpheres(const glm::mat4& viewProjection, GLuint buffer, size_t instanceOffset, size_t idOffset, size_t count, size_t revealedFirst,
+                     const std::vector<MeshHandle>& levels, const std::vector<GLuint>& bucketStart, size_t objectCount) {
+        size_t revealedCount = count - revealedFirst;
+        uploadCommands(levels, bucketStart);
+        reserveSurvivors(revealedCount);
+        reserveVisibility(objectCount);
+
+        // Nothing reads the slot being overwritten any more, finished or not
+        GLuint visibility = visibilityBuffers[visibilityFrame];
+        if (visibilityFences[visibilityFrame] != nullptr) {
+            glDeleteSync(visibilityFences[visibilityFrame]);
+            visibilityFences[visibilityFrame] = nullptr;
+        }
+        glState().bindBuffer(GL_SHADER_STORAGE_BUFFER, visibility);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+        if (count > 0) {
+            glState().useProgram(cullProgram);
+            glUniformMatrix4fv(cullViewProjectionLoc, 1, GL_FALSE, glm::value_ptr(viewProjection));
+            glUniform1ui(cullCandidateCountLoc, GLuint(count));
+            glUniform1ui(cullRevealedFirstLoc, GLuint(revealedFirst));
+            glUniform1ui(cullBucketCountLoc, GLuint(bucketStart.size() - 1));
+            glUniform1uiv(cullBucketStartLoc, GLsizei(bucketStart.size()), bucketStart.data());
+            glState().bindTexture(0, GL_TEXTURE_2D, pyramidTexture);
+
+            glState().bindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, buffer, instanceOffset, count * sizeof(SphereInstance));
+            glState().bindBufferRange(GL_SHADER_STORAGE_BUFFER, 1, buffer, idOffset, count * sizeof(uint32_t));
+            glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, survivorBuffer);
+            glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, commandBuffer);
+            glState().bindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibility);
+            glDispatchCompute(GLuint((count + 63) / 64), 1, 1);
+        }
+
+        // Survivors feed vertex attributes and the counts feed indirect draws; visibility goes back to the CPU
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        visibilityFences[visibilityFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        visibilityFrame = (visibilityFrame + 1) % FRAME_COUNT;
+    }
+
+    // Copies the newest finished testSpheres() visibility, one bit per object, if there is one the caller
+    // has not seen yet; never waits. Objects that were not candidates read as hidden
+    bool readVisibility(std::vector<uint32_t>& bits) {
+        for (int age = 1; age <= FRAME_COUNT; age++) {
+            int slot = (visibilityFrame - age + FRAME_COUNT) % FRAME_COUNT;
+            if (visibilityFences[slot] == nullptr) {
+                return false; // Read already, so everything older is stale
+            }
+            if (glClientWaitSync(visibilityFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+                continue;
+            }
+
+            bits.resize(visibilityWords);
+            glState().bindBuffer(GL_COPY_READ_BUFFER, visibilityBuffers[slot]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, visibilityWords * sizeof(uint32_t), bits.data());
+            for (int older = age; older <= FRAME_COUNT; older++) {
+                GLsync& fence = visibilityFences[(visibilityFrame - older + FRAME_COUNT) % FRAME_COUNT];
+                if (fence != nullptr) {
+                    glDeleteSync(fence);
+                    fence = nullptr;
+                }
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // SphereInstances that passed the last testSpheres(), at the commands' base instances
+    GLuint getSurvivorBuffer() const {
+        return survivorBuffer;
+    }
+
+    GLuint getCommandBuffer() const {
+        return commandBuffer;
+    }
+
+    static size_t storageOffsetAlignment() {
+        GLint alignment = 0;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        return std::max(alignment, 1);
+    }
+
+private:
+    bool hiZ;
+    GLuint proxyProgram;
+    GLuint proxyVAO;
+    GLint proxyViewProjectionLoc, proxyBoxMinLoc, proxyBoxMaxLoc;
+    std::vector<GLuint> queries;
+    std::vector<uint8_t> pending;
+
+    GLuint depthTexture;
+    GLuint pyramidTexture; // GL_R32F, farthest depth per texel
+    int viewportWidth, viewportHeight;
+    int pyramidWidth, pyramidHeight, pyramidLevels;
+    GLuint downsampleProgram, cullProgram; // Built with the first pyramid
+    GLint downsampleSourceLevelLoc;
+    GLint cullViewProjectionLoc, cullCandidateCountLoc, cullRevealedFirstLoc, cullBucketCountLoc, cullBucketStartLoc;
+    GLuint survivorBuffer;
+    size_t survivorCapacity; // In instances
+    GLuint commandBuffer;
+    GLuint visibilityBuffers[FRAME_COUNT];
+    GLsync visibilityFences[FRAME_COUNT];
+    size_t visibilityWords;
+    int visibilityFrame; // Slot the next testSpheres() writes
+
+    // Unit cube from gl_VertexID, stretched over the box; no vertex buffer
+    static constexpr const char* proxyVertexSource = R"glsl(#version 330 core
+    uniform mat4 viewProjection;
+    uniform vec3 boxMin;
+    uniform vec3 boxMax;
+
+    // Corner i has x from bit 0, y from bit 1, z from bit 2
+    const int corners[36] = int[36](0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+                                    2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5);
+
+    void main() {
+        int corner = corners[gl_VertexID];
+        vec3 t = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+        gl_Position = viewProjection * vec4(mix(boxMin, boxMax, t), 1.0);
+    }
+)glsl";
+
+    static constexpr const char* proxyFragmentSource = R"glsl(#version 330 core
+    void main() {}
+)glsl";
+
+    // One destination texel per invocation: the farthest depth of every source texel it overlaps,
+    // so any size ratio between levels stays conservative
+    static constexpr const char* downsampleSource = R"glsl(#version 430 core
+    layout (local_size_x = 8, local_size_y = 8) in;
+
+    uniform sampler2D source;
+    uniform int sourceLevel;
+    layout (r32f, binding = 0) writeonly uniform image2D destination;
+
+    void main() {
+        ivec2 size = imageSize(destination);
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (any(greaterThanEqual(texel, size)))
+            return;
+
+        ivec2 sourceSize = textureSize(source, sourceLevel);
+        ivec2 begin = texel * sourceSize / size;
+        ivec2 end = ((texel + 1) * sourceSize + size - 1) / size;
+        float farthest = 0.0;
+        for (int y = begin.y; y < end.y; y++)
+            for (int x = begin.x; x < end.x; x++)
+                farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+        imageStore(destination, texel, vec4(farthest));
+    }
+)glsl";
+
+    // One candidate per invocation. The sphere's bounding box is projected to a screen rectangle and its
+    // nearest depth; at the pyramid level where the rectangle spans at most 2x2 texels, the sphere is
+    // hidden if it is behind all of them
+    static constexpr const char* cullSource = R"glsl(#version 430 core
+    layout (local_size_x = 64) in;
+
+    struct SphereInstance {
+        vec4 positionRadius;
+        vec4 color;
+    };
+
+    layout (std430, binding = 0) readonly buffer Candidates { SphereInstance candidates[]; };
+    layout (std430, binding = 1) readonly buffer CandidateIds { uint candidateIds[]; };
+    layout (std430, binding = 2) writeonly buffer Survivors { SphereInstance survivors[]; };
+    layout (std430, binding = 3) buffer Commands { uint commands[]; }; // 5 words per level; the impostors' 4 come last
+    layout (std430, binding = 4) buffer Visibility { uint visibleBits[]; };
+
+    uniform mat4 viewProjection;
+    uniform sampler2D pyramid;
+    uniform uint candidateCount;
+    uniform uint revealedFirst;
+    uniform uint bucketCount;
+    uniform uint bucketStart[17];
+
+    bool inFrontOfPyramid(vec4 sphere) {
+        vec3 low = vec3(1.0e30);
+        vec3 high = vec3(-1.0e30);
+        for (int corner = 0; corner < 8; corner++) {
+            vec3 side = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1) * 2.0 - 1.0;
+            vec4 clip = viewProjection * vec4(sphere.xyz + sphere.w * side, 1.0);
+            if (clip.w <= 0.0)
+                return true; // Reaches behind the camera
+            vec3 ndc = clip.xyz / clip.w;
+            low = min(low, ndc);
+            high = max(high, ndc);
+        }
+
+        vec2 uvMin = clamp(low.xy * 0.5 + 0.5, 0.0, 1.0);
+        vec2 uvMax = clamp(high.xy * 0.5 + 0.5, 0.0, 1.0);
+        float nearest = low.z * 0.5 + 0.5;
+
+        vec2 extent = (uvMax - uvMin) * vec2(textureSize(pyramid, 0));
+        int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, textureQueryLevels(pyramid) - 1);
+        ivec2 levelSize = textureSize(pyramid, level);
+        ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+        ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+        float farthest = 0.0;
+        for (int y = texelMin.y; y <= texelMax.y; y++)
+            for (int x = texelMin.x; x <= texelMax.x; x++)
+                farthest = max(farthest, texelFetch(pyramid, ivec2(x, y), level).r);
+        return nearest <= farthest;
+    }
+
+    void main() {
+        uint i = gl_GlobalInvocationID.x;
+        if (i >= candidateCount)
+            return;
+
+        SphereInstance candidate = candidates[i];
+        if (!inFrontOfPyramid(candidate.positionRadius))
+            return;
+
+        uint id = candidateIds[i];
+        atomicOr(visibleBits[id >> 5], 1u << (id & 31u));
+
+        if (i >= revealedFirst) {
+            uint revealedIndex = i - revealedFirst;
+            uint bucket = 0u;
+            while (bucket + 1u < bucketCount && revealedIndex >= bucketStart[bucket + 1u])
+                bucket++;
+            uint slot = atomicAdd(commands[5u * bucket + 1u], 1u);
+            survivors[bucketStart[bucket] + slot] = candidate;
+        }
+    }
+)glsl";
+
+    void allocatePyramid(int width, int height) {
+        if (downsampleProgram == 0) {
+            downsampleProgram = createComputeProgram(createShader(GL_COMPUTE_SHADER, downsampleSource));
+            downsampleSourceLevelLoc = glGetUniformLocation(downsampleProgram, "sourceLevel");
+            cullProgram = createComputeProgram(createShader(GL_COMPUTE_SHADER, cullSource));
+            cullViewProjectionLoc = glGetUniformLocation(cullProgram, "viewProjection");
+            cullCandidateCountLoc = glGetUniformLocation(cullProgram, "candidateCount");
+            cullRevealedFirstLoc = glGetUniformLocation(cullProgram, "revealedFirst");
+            cullBucketCountLoc = glGetUniformLocation(cullProgram, "bucketCount");
+            cullBucketStartLoc = glGetUniformLocation(cullProgram, "bucketStart");
+        }
+        if (width == viewportWidth && height == viewportHeight) {
+            return;
+        }
+
+        viewportWidth = width;
+        viewportHeight = height;
+        pyramidWidth = 1;
+        while (pyramidWidth * 2 <= width)
+            pyramidWidth *= 2;
+        pyramidHeight = 1;
+        while (pyramidHeight * 2 <= height)
+            pyramidHeight *= 2;
+        pyramidLevels = 1;
+        while ((std::max(pyramidWidth, pyramidHeight) >> pyramidLevels) > 0)
+            pyramidLevels++;
+
+        // Immutable storage, so both have to be recreated at a new size
+        glState().deleteTextures(1, &depthTexture);
+        glState().deleteTextures(1, &pyramidTexture);
+
+        glGenTextures(1, &depthTexture);
+        glState().bindTexture(0, GL_TEXTURE_2D, depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        glGenTextures(1, &pyramidTexture);
+        glState().bindTexture(0, GL_TEXTURE_2D, pyramidTexture);
+        glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, pyramidWidth, pyramidHeight);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    // Zero instance counts; the cull shader adds the survivors
+    void uploadCommands(const std::vector<MeshHandle>& levels, const std::vector<GLuint>& bucketStart) {
+        std::vector<DrawElementsIndirectCommand> commands(levels.size());
+        for (size_t level = 0; level < levels.size(); level++) {
+            commands[level].count = levels[level].indexCount;
+            commands[level].instanceCount = 0;
+            commands[level].firstIndex = levels[level].firstIndex;
+            commands[level].baseVertex = levels[level].baseVertex;
+            commands[level].baseInstance = bucketStart[level];
+        }
+        DrawArraysIndirectCommand impostorCommand = { 4, 0, 0, bucketStart[levels.size()] };
+
+        size_t levelBytes = commands.size() * sizeof(DrawElementsIndirectCommand);
+        if (commandBuffer == 0)
+            glGenBuffers(1, &commandBuffer);
+        glState().bindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        // Orphaned every frame so the driver need not wait for last frame's draws
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, levelBytes + sizeof(impostorCommand), nullptr, GL_DYNAMIC_COPY);
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, levelBytes, commands.data());
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, levelBytes, sizeof(impostorCommand), &impostorCommand);
+    }
+
+    void reserveSurvivors(size_t count) {
+        if (count <= survivorCapacity && survivorBuffer != 0) {
+            return;
+        }
+
+        survivorCapacity = std::max(count, survivorCapacity * 2);
+        glState().deleteBuffers(1, &survivorBuffer);
+        glGenBuffers(1, &survivorBuffer);
+        glState().bindBuffer(GL_ARRAY_BUFFER, survivorBuffer);
+        glBufferData(GL_ARRAY_BUFFER, std::max<size_t>(survivorCapacity, 1) * sizeof(SphereInstance), nullptr, GL_DYNAMIC_COPY);
+    }
+
+    void reserveVisibility(size_t objectCount) {
+        size_t words = std::max<size_t>((objectCount + 31) / 32, 1);
+        if (words == visibilityWords) {
+            return;
+        }
+
+        releaseVisibility();
+        visibilityWords = words;
+        glGenBuffers(FRAME_COUNT, visibilityBuffers);
+        for (GLuint buffer : visibilityBuffers) {
+            glState().bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, words * sizeof(uint32_t), nullptr, GL_DYNAMIC_READ);
+        }
+    }
+
+    void releaseVisibility() {
+        for (int slot = 0; slot < FRAME_COUNT; slot++) {
+            if (visibilityFences[slot] != nullptr) {
+                glDeleteSync(visibilityFences[slot]);
+                visibilityFences[slot] = nullptr;
+            }
+        }
+        if (visibilityWords > 0)
+            glState().deleteBuffers(FRAME_COUNT, visibilityBuffers);
+        std::fill_n(visibilityBuffers, FRAME_COUNT, 0);
+        visibilityWords = 0;
+        visibilityFrame = 0;
+    }
+};
+
+#endif // OCCLUSION_H
@@ -0,0 +1,211 @@
+#ifndef SPHEREGENERATORS_H
+#define SPHEREGENERATORS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "graphics.hpp"
+
+// Sphere topologies besides the icosphere, all producing unit-radius IndexedMeshes
+
+enum CubeSphereMapping {
+    CUBE_SPHERE_NORMALIZED, // Project each cube point straight onto the sphere; cells near face centres are ~5x larger than at corners
+    CUBE_SPHERE_EQUAL_AREA  // Rosca-Plonka: every grid cell covers exactly the same solid angle. Cell edges are curved,
+                            // so the spherical quads through cell corners still vary by ~6% and the flat triangles by more
+};
+
+// Maps face coordinates (u, v) in [-1, 1]^2 to the unit sphere, in a frame where the face normal is +z.
+//
+// Equal-area version (Rosca and Plonka, "Uniform spherical grids via equal area
+// projection from the cube to the sphere", 2011): each quarter of the face (the
+// wedge around one axis) is mapped ray by ray onto the face's curved square in
+// the Lambert azimuthal plane, with constant Jacobian, and from there to the
+// sphere by the inverse Lambert projection, which is itself area-preserving.
+// The curved square's area up to azimuth a is a - asin(sin(a) / sqrt(2)); setting
+// it to g = pi/12 * v/u gives tan(b) = sin(g) / (sqrt(2) - cos(g)), azimuth = b + g.
+inline Vec3 cubeFaceToSphere(float u, float v, CubeSphereMapping mapping) {
+    if (mapping == CUBE_SPHERE_NORMALIZED) {
+        return Vec3(u, v, 1.0f).normalize();
+    }
+
+    const double pi = 3.14159265358979323846;
+    double absU = std::fabs(u);
+    double absV = std::fabs(v);
+    double major = absU >= absV ? u : v;
+    if (major == 0.0) {
+        return Vec3(0.0f, 0.0f, 1.0f);
+    }
+
+    double t = (absU >= absV ? v : u) / major;
+    double gamma = pi / 12.0 * t;
+    double azimuth = gamma + std::atan(std::sin(gamma) / (std::sqrt(2.0) - std::cos(gamma)));
+
+    // Lambert radius of the face edge along this azimuth, scaled down linearly toward the centre
+    double edgeCos = std::cos(azimuth);
+    double edgeRadiusSquared = 2.0 * (1.0 - edgeCos / std::sqrt(1.0 + edgeCos * edgeCos));
+    double radiusSquared = major * major * edgeRadiusSquared;
+
+    double z = 1.0 - radiusSquared / 2.0;
+    double planar = std::sqrt(radiusSquared * (1.0 - radiusSquared / 4.0));
+    double along = (major > 0.0 ? planar : -planar) * std::cos(azimuth); // Along the major axis
+    double across = (major > 0.0 ? planar : -planar) * std::sin(azimuth);
+
+    if (absU >= absV)
+        return Vec3(float(along), float(across), float(z));
+    return Vec3(float(across), float(along), float(z));
+}
+
+// Six (segments x segments) grids, one per cube face. Vertices on cube edges are
+// shared between faces, so the mesh is watertight.
+inline IndexedMesh createCubeSphere(int segments, CubeSphereMapping mapping = CUBE_SPHERE_EQUAL_AREA, NormalMode normalMode = NORMALS_OMIT) {
+    segments = std::max(segments, 1); // One quad per face is the plain cube
+    IndexedMesh mesh;
+    size_t n = segments;
+    mesh.vertices.reserve(6 * n * n + 2);
+    mesh.indices.reserve(36 * n * n);
+
+    // Face frames as axis indices, with u x v along the normal so quads wind counter-clockwise from outside
+    struct Face { int normal, u, v; float sign; };
+    const Face faces[6] = {
+        { 0, 1, 2, 1.0f }, { 0, 1, 2, -1.0f },
+        { 1, 2, 0, 1.0f }, { 1, 2, 0, -1.0f },
+        { 2, 0, 1, 1.0f }, { 2, 0, 1, -1.0f }
+    };
+
+    // Edge vertices are keyed by their integer position on the cube lattice so every face finds the same one
+    std::unordered_map<uint64_t, unsigned int> latticeIndex;
+    std::vector<unsigned int> grid((n + 1) * (n + 1));
+
+    for (const Face& face : faces) {
+        for (size_t j = 0; j <= n; j++) {
+            for (size_t i = 0; i <= n; i++) {
+                int lattice[3];
+                lattice[face.normal] = face.sign > 0.0f ? segments : 0;
+                // Mirror one in-face axis on negative faces to keep the winding outward
+                lattice[face.u] = face.sign > 0.0f ? int(i) : segments - int(i);
+                lattice[face.v] = int(j);
+
+                bool interior = i > 0 && i < n && j > 0 && j < n;
+                uint64_t key = (uint64_t(lattice[0]) << 42) | (uint64_t(lattice[1]) << 21) | uint64_t(lattice[2]);
+                auto it = interior ? latticeIndex.end() : latticeIndex.find(key);
+
+                if (it != latticeIndex.end()) {
+                    grid[j * (n + 1) + i] = it->second;
+                    continue;
+                }
+
+                float u = 2.0f * lattice[face.u] / segments - 1.0f;
+                float v = 2.0f * lattice[face.v] / segments - 1.0f;
+                Vec3 local = cubeFaceToSphere(u, v, mapping);
+
+                float world[3];
+                world[face.u] = local.x;
+                world[face.v] = local.y;
+                world[face.normal] = face.sign * local.z;
+
+                unsigned int index = mesh.vertices.size();
+                mesh.vertices.push_back(Vec3(world[0], world[1], world[2]));
+                grid[j * (n + 1) + i] = index;
+                if (!interior)
+                    latticeIndex.emplace(key, index);
+            }
+        }
+
+        for (size_t j = 0; j < n; j++) {
+            for (size_t i = 0; i < n; i++) {
+                unsigned int a = grid[j * (n + 1) + i];
+                unsigned int b = grid[j * (n + 1) + i + 1];
+                unsigned int c = grid[(j + 1) * (n + 1) + i + 1];
+                unsigned int d = grid[(j + 1) * (n + 1) + i];
+                mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+            }
+        }
+    }
+
+    if (normalMode == NORMALS_EMIT) {
+        mesh.normals = normalsFromPositions(mesh.vertices);
+    }
+
+    return mesh;
+}
+
+// Latitude/longitude sphere with single pole vertices and 2 * rings segments around
+inline IndexedMesh createUVSphere(int rings, NormalMode normalMode = NORMALS_OMIT) {
+    const float pi = 3.14159265358979f;
+    rings = std::max(rings, 2); // Fewer rings leave nothing between the poles
+    unsigned int segments = 2 * rings;
+
+    IndexedMesh mesh;
+    mesh.vertices.reserve((rings - 1) * segments + 2);
+    mesh.indices.reserve(6 * segments * (rings - 1));
+
+    mesh.vertices.push_back(Vec3(0.0f, 1.0f, 0.0f));
+    for (int ring = 1; ring < rings; ring++) {
+        float polar = pi * ring / rings;
+        for (unsigned int segment = 0; segment < segments; segment++) {
+            float azimuth = 2.0f * pi * segment / segments;
+            mesh.vertices.push_back(Vec3(std::sin(polar) * std::cos(azimuth), std::cos(polar), -std::sin(polar) * std::sin(azimuth)));
+        }
+    }
+    unsigned int southPole = mesh.vertices.size();
+    mesh.vertices.push_back(Vec3(0.0f, -1.0f, 0.0f));
+
+    auto ringVertex = [segments](int ring, unsigned int segment) {
+        return 1 + (ring - 1) * segments + segment % segments;
+    };
+
+    for (unsigned int segment = 0; segment < segments; segment++) {
+        mesh.indices.insert(mesh.indices.end(), { 0u, ringVertex(1, segment), ringVertex(1, segment + 1) });
+    }
+    for (int ring = 1; ring < rings - 1; ring++) {
+        for (unsigned int segment = 0; segment < segments; segment++) {
+            unsigned int a = ringVertex(ring, segment);
+            unsigned int b = ringVertex(ring + 1, segment);
+            unsigned int c = ringVertex(ring + 1, segment + 1);
+            unsigned int d = ringVertex(ring, segment + 1);
+            mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+        }
+    }
+    for (unsigned int segment = 0; segment < segments; segment++) {
+        mesh.indices.insert(mesh.indices.end(), { ringVertex(rings - 1, segment), southPole, ringVertex(rings - 1, segment + 1) });
+    }
+
+    if (normalMode == NORMALS_EMIT) {
+        mesh.normals = normalsFromPositions(mesh.vertices);
+    }
+
+    return mesh;
+}
+
+enum SphereTopology {
+    SPHERE_TOPOLOGY_ICOSPHERE,
+    SPHERE_TOPOLOGY_CUBE,
+    SPHERE_TOPOLOGY_CUBE_EQUAL_AREA,
+    SPHERE_TOPOLOGY_UV
+};
+
+inline const char* sphereTopologyName(SphereTopology topology) {
+    switch (topology) {
+    case SPHERE_TOPOLOGY_ICOSPHERE: return "icosphere";
+    case SPHERE_TOPOLOGY_CUBE: return "cube (normalized)";
+    case SPHERE_TOPOLOGY_CUBE_EQUAL_AREA: return "cube (equal-area)";
+    default: return "uv";
+    }
+}
+
+// Common entry point. `detail` is the subdivision level for icospheres, the
+// segments per face edge for cube spheres and the ring count for UV spheres.
+inline IndexedMesh createSphere(SphereTopology topology, int detail, NormalMode normalMode = NORMALS_OMIT) {
+    switch (topology) {
+    case SPHERE_TOPOLOGY_ICOSPHERE: return createIndexedIcosphere(detail, normalMode);
+    case SPHERE_TOPOLOGY_CUBE: return createCubeSphere(detail, CUBE_SPHERE_NORMALIZED, normalMode);
+    case SPHERE_TOPOLOGY_CUBE_EQUAL_AREA: return createCubeSphere(detail, CUBE_SPHERE_EQUAL_AREA, normalMode);
+    default: return createUVSphere(detail, normalMode);
+    }
+}
+
+#endif // SPHEREGENERATORS_H
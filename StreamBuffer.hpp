@@ -0,0 +1,174 @@
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "GLState.hpp"
+
+// Ring buffer for data rewritten every frame (instances, uniform blocks).
+//
+// With GL 4.4 / ARB_buffer_storage the buffer is mapped once, persistently and
+// coherently, and split into three per-frame regions: the CPU writes frame N
+// while the GPU may still read frames N-1 and N-2, and a fence per region only
+// blocks if the CPU gets three frames ahead. On GL 3.3 the buffer is orphaned at
+// the start of each frame and filled with glBufferSubData instead.
+//
+// Writes return byte offsets into getBuffer(); call endFrame() once all of the
+// frame's draws that read the buffer have been issued.
+class StreamBuffer {
+public:
+    static const int FRAME_COUNT = 3;
+
+    StreamBuffer(GLenum target, size_t frameCapacity)
+        : target(target), buffer(0), mapped(nullptr), frameCapacity(0), frame(0), head(0), frameStarted(false),
+          persistent(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage), uniformAlignment(0) {
+        std::fill_n(fences, FRAME_COUNT, nullptr);
+        allocate(std::max<size_t>(frameCapacity, 1));
+    }
+
+    ~StreamBuffer() {
+        destroy();
+    }
+
+    StreamBuffer(const StreamBuffer&) = delete;
+    StreamBuffer& operator=(const StreamBuffer&) = delete;
+
+    // Copies `bytes` into this frame's region at an offset that is a multiple of `alignment`
+    size_t write(const void* data, size_t bytes, size_t alignment = 1) {
+        if (!frameStarted) {
+            beginFrame();
+        }
+
+        size_t frameBase = persistent ? frame * frameCapacity : 0;
+        size_t offset = alignUp(frameBase + head, alignment);
+        if (offset + bytes > frameBase + frameCapacity) {
+            // Earlier draws this frame keep reading the old storage, so starting over in a new buffer is safe
+            destroy();
+            allocate(std::max(frameCapacity * 2, bytes + alignment));
+            beginFrame();
+            frameBase = 0;
+            offset = 0;
+        }
+
+        if (persistent) {
+            std::memcpy(static_cast<char*>(mapped) + offset, data, bytes);
+        } else {
+            glState().bindBuffer(target, buffer);
+            glBufferSubData(target, offset, bytes, data);
+        }
+        head = offset + bytes - frameBase;
+
+        return offset;
+    }
+
+    // Writes a uniform block and binds it to `bindingPoint` of GL_UNIFORM_BUFFER
+    void writeUniformBlock(GLuint bindingPoint, const void* data, size_t bytes) {
+        if (uniformAlignment == 0)
+            uniformAlignment = uniformOffsetAlignment();
+        size_t offset = write(data, bytes, uniformAlignment);
+        glState().bindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, buffer, offset, bytes);
+    }
+
+    // Fences the frame's region and moves on to the next one
+    void endFrame() {
+        if (!frameStarted) {
+            return;
+        }
+
+        if (persistent) {
+            fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            frame = (frame + 1) % FRAME_COUNT;
+        }
+        head = 0;
+        frameStarted = false;
+    }
+
+    GLuint getBuffer() const {
+        return buffer;
+    }
+
+    bool isPersistent() const {
+        return persistent;
+    }
+
+    static size_t uniformOffsetAlignment() {
+        GLint alignment = 0;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        return std::max(alignment, 1);
+    }
+
+private:
+    GLenum target;
+    GLuint buffer;
+    void* mapped; // Whole buffer, persistent mode only
+    size_t frameCapacity; // Bytes per frame region
+    int frame;
+    size_t head; // Bytes used in the current region
+    bool frameStarted;
+    bool persistent;
+    size_t uniformAlignment; // Queried on first use
+    GLsync fences[FRAME_COUNT];
+
+    static size_t alignUp(size_t offset, size_t alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    void allocate(size_t capacity) {
+        frameCapacity = capacity;
+        frame = 0;
+        head = 0;
+        frameStarted = false;
+
+        glGenBuffers(1, &buffer);
+        glState().bindBuffer(target, buffer);
+        if (persistent) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(target, FRAME_COUNT * frameCapacity, nullptr, flags);
+            mapped = glMapBufferRange(target, 0, FRAME_COUNT * frameCapacity, flags);
+        } else {
+            glBufferData(target, frameCapacity, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    void destroy() {
+        for (GLsync& fence : fences) {
+            if (fence != nullptr) {
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+        }
+        if (mapped != nullptr) {
+            glState().bindBuffer(target, buffer);
+            glUnmapBuffer(target);
+            mapped = nullptr;
+        }
+        glState().deleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    void beginFrame() {
+        frameStarted = true;
+        head = 0;
+
+        if (!persistent) {
+            // Orphan the old storage so the driver need not wait for last frame's draws
+            glState().bindBuffer(target, buffer);
+            glBufferData(target, frameCapacity, nullptr, GL_STREAM_DRAW);
+            return;
+        }
+
+        // The GPU is normally done with this region already; only wait when it is three frames behind
+        GLsync& fence = fences[frame];
+        if (fence != nullptr) {
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+};
+
+#endif // STREAMBUFFER_H
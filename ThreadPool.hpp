@@ -0,0 +1,99 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads pulling jobs from a shared queue
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency()) : stopping(false) {
+        threadCount = std::max(threadCount, 1u);
+        for (unsigned int i = 0; i < threadCount; i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const {
+        return workers.size();
+    }
+
+    // Runs task(i) for every i in [0, count) and blocks until all calls have returned.
+    // Indices are handed out dynamically, so uneven tasks still balance across threads.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task) {
+        std::atomic<size_t> next(0);
+        auto drain = [&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                task(i);
+            }
+        };
+
+        // The calling thread works too, so one fewer job than there are indices at most
+        size_t helpers = std::min<size_t>(workers.size(), count > 0 ? count - 1 : 0);
+        size_t remaining = helpers;
+        std::mutex doneMutex;
+        std::condition_variable done;
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            for (size_t i = 0; i < helpers; i++) {
+                jobs.push([&]() {
+                    drain();
+                    std::lock_guard<std::mutex> doneLock(doneMutex);
+                    if (--remaining == 0)
+                        done.notify_one();
+                });
+            }
+        }
+        wakeWorkers.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&]() { return remaining == 0; });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex queueMutex;
+    std::condition_variable wakeWorkers;
+    bool stopping;
+
+    void workerLoop() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                wakeWorkers.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+};
+
+#endif // THREADPOOL_H
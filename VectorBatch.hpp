@@ -0,0 +1,128 @@
+#ifndef VECTORBATCH_H
+#define VECTORBATCH_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/simd/platform.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include "graphics.hpp"
+
+// Batch normalization of 3D vectors. The SIMD paths use a reciprocal square
+// root estimate refined with Newton-Raphson steps, which is accurate to a few ulps.
+
+// glm only sets the SIMD bits of GLM_ARCH under GLM_FORCE_INTRINSICS, which the
+// vendored vec4 SIMD code does not build with, so fall back to the same
+// compiler macros platform.h checks. Build with -mavx for the 8-wide path.
+#if (GLM_ARCH & GLM_ARCH_AVX_BIT) || defined(__AVX__)
+#   define VECTORBATCH_AVX 1
+#   include <immintrin.h>
+#endif
+#if (GLM_ARCH & GLM_ARCH_SSE2_BIT) || defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#   define VECTORBATCH_SSE2 1
+#   include <emmintrin.h>
+#elif (GLM_ARCH & GLM_ARCH_NEON_BIT) || defined(__ARM_NEON)
+#   define VECTORBATCH_NEON 1
+#   include <arm_neon.h>
+#endif
+
+#ifdef VECTORBATCH_SSE2
+// 1 / sqrt(x) from the 12-bit estimate plus one Newton step
+inline __m128 rsqrtNewton(__m128 x) {
+    __m128 r = _mm_rsqrt_ps(x);
+    __m128 halfXrr = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), x), _mm_mul_ps(r, r));
+    return _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), halfXrr));
+}
+#endif
+
+#ifdef VECTORBATCH_AVX
+inline __m256 rsqrtNewton(__m256 x) {
+    __m256 r = _mm256_rsqrt_ps(x);
+    __m256 halfXrr = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), x), _mm256_mul_ps(r, r));
+    return _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5f), halfXrr));
+}
+#endif
+
+#ifdef VECTORBATCH_NEON
+// The NEON estimate is only ~8 bits, so it takes two steps
+inline float32x4_t rsqrtNewton(float32x4_t x) {
+    float32x4_t r = vrsqrteq_f32(x);
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+    r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(x, r), r));
+    return r;
+}
+#endif
+
+// Normalizes `count` vectors stored as separate x, y and z arrays. No shuffling is needed, so it
+// runs 8-wide where AVX is available
+inline void normalizeBatch(float* x, float* y, float* z, size_t count) {
+    size_t i = 0;
+
+#ifdef VECTORBATCH_AVX
+    for (; i + 8 <= count; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+        __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+        __m256 s = rsqrtNewton(lengthSquared);
+        _mm256_storeu_ps(x + i, _mm256_mul_ps(vx, s));
+        _mm256_storeu_ps(y + i, _mm256_mul_ps(vy, s));
+        _mm256_storeu_ps(z + i, _mm256_mul_ps(vz, s));
+    }
+#endif
+
+#ifdef VECTORBATCH_NEON
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t vx = vld1q_f32(x + i);
+        float32x4_t vy = vld1q_f32(y + i);
+        float32x4_t vz = vld1q_f32(z + i);
+        float32x4_t lengthSquared = vmlaq_f32(vmlaq_f32(vmulq_f32(vx, vx), vy, vy), vz, vz);
+        float32x4_t s = rsqrtNewton(lengthSquared);
+        vst1q_f32(x + i, vmulq_f32(vx, s));
+        vst1q_f32(y + i, vmulq_f32(vy, s));
+        vst1q_f32(z + i, vmulq_f32(vz, s));
+    }
+#elif defined(VECTORBATCH_SSE2)
+    for (; i + 4 <= count; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+        __m128 s = rsqrtNewton(lengthSquared);
+        _mm_storeu_ps(x + i, _mm_mul_ps(vx, s));
+        _mm_storeu_ps(y + i, _mm_mul_ps(vy, s));
+        _mm_storeu_ps(z + i, _mm_mul_ps(vz, s));
+    }
+#endif
+
+    for (; i < count; i++) {
+        float length = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        x[i] /= length;
+        y[i] /= length;
+        z[i] /= length;
+    }
+}
+
+// Vec3s are copied member by member into structure-of-arrays blocks and back,
+// so the struct array is never read as a flat float array
+inline void normalizeBatch(Vec3* vectors, size_t count) {
+    const size_t BLOCK_SIZE = 256;
+    float x[BLOCK_SIZE], y[BLOCK_SIZE], z[BLOCK_SIZE];
+
+    for (size_t start = 0; start < count; start += BLOCK_SIZE) {
+        Vec3* block = vectors + start;
+        size_t blockCount = std::min(BLOCK_SIZE, count - start);
+        for (size_t i = 0; i < blockCount; i++) {
+            x[i] = block[i].x;
+            y[i] = block[i].y;
+            z[i] = block[i].z;
+        }
+        normalizeBatch(x, y, z, blockCount);
+        for (size_t i = 0; i < blockCount; i++)
+            block[i] = Vec3(x[i], y[i], z[i]);
+    }
+}
+
+#endif // VECTORBATCH_H
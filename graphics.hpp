@@ -1,14 +1,114 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include <cstdint>
+
+class ThreadPool;
+
 // Define a simple 3D vector class
 struct Vec3 {
     float x, y, z;
-    Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
+    constexpr Vec3() : x(0.0f), y(0.0f), z(0.0f) {}
+    constexpr Vec3(float x, float y, float z) : x(x), y(y), z(z) {}
     Vec3 normalize() const;
     Vec3 operator+(const Vec3& other) const;
 };
 
+// Unique vertices plus triangle indices into them
+struct IndexedMesh {
+    std::vector<Vec3> vertices;
+    std::vector<glm::vec3> normals; // Empty unless the generator was asked to emit them
+    std::vector<unsigned int> indices;
+};
+
+// On a unit sphere the normal is the position, so generators can either emit it
+// alongside the positions or leave it to the vertex shader
+enum NormalMode {
+    NORMALS_OMIT,
+    NORMALS_EMIT
+};
+
+// Copies unit-sphere positions into a normal array
+std::vector<glm::vec3> normalsFromPositions(const std::vector<Vec3>& positions);
+
+// Non-owning view of mesh data that lives elsewhere (an IndexedMesh, a mapped cache file, ...)
+struct MeshView {
+    const Vec3* vertices;
+    size_t vertexCount;
+    const glm::vec3* normals; // Null when the mesh has no normals
+    const unsigned int* indices; // Null for non-indexed meshes
+    size_t indexCount;
+};
+
+MeshView makeMeshView(const std::vector<Vec3>& vertices, const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& normals);
+
+MeshView makeMeshView(const IndexedMesh& mesh);
+
+// GPU-side vertex encodings. The compact ones rely on meshes being unit spheres.
+enum VertexFormat {
+    VERTEX_FORMAT_FLOAT,     // Vec3 position (+ glm::vec3 normal in its own VBO): 12-24 bytes
+    VERTEX_FORMAT_PACKED,    // snorm16 position + octahedral snorm16 normal: 12 bytes
+    VERTEX_FORMAT_OCTAHEDRAL, // Octahedral snorm16 normal only, the position is the decoded normal: 4 bytes
+    VERTEX_FORMAT_FLOAT_NORMAL // Interleaved Vec3 position + glm::vec3 normal: 24 bytes
+};
+
+struct PackedVertex {
+    int16_t position[4]; // snorm16 xyz; w is padding so the normal stays 4-byte aligned
+    int16_t normal[2]; // Octahedral-encoded unit normal
+};
+
+struct OctahedralVertex {
+    int16_t normal[2]; // Octahedral-encoded unit normal
+};
+
+struct FloatNormalVertex {
+    Vec3 position;
+    glm::vec3 normal;
+};
+
+// Bytes per vertex in the VBO for a format
+size_t vertexFormatStride(VertexFormat format);
+
+int16_t packSnorm16(float value);
+
+// Maps a unit vector onto the [-1, 1]^2 octahedron parameterization
+void octahedralEncode(const Vec3& normal, int16_t encoded[2]);
+
+// Missing normals are taken from the (unit) positions
+std::vector<PackedVertex> packVertices(const MeshView& mesh);
+
+std::vector<OctahedralVertex> packOctahedralVertices(const MeshView& mesh);
+
+std::vector<FloatNormalVertex> interleaveVertices(const MeshView& mesh);
+
+// Per-instance data for instanced sphere drawing, read with a vertex attribute divisor of 1
+struct SphereInstance {
+    glm::vec4 positionRadius; // World-space centre in xyz, radius in w
+    glm::vec4 color; // rgb; a is unused
+};
+
+// Fixed uniform block binding points, shared by every shader program
+enum UniformBinding {
+    UNIFORM_BINDING_CAMERA = 0, // CameraBlock, rewritten every frame
+    UNIFORM_BINDING_LIGHT = 1   // LightBlock, set once per scene
+};
+
+// std140 mirrors of the GLSL Camera and Light blocks; each vec3 is padded out to 16 bytes
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 viewPos;
+    float padding;
+};
+
+struct LightBlock {
+    glm::vec3 lightPos;
+    float padding0;
+    glm::vec3 lightColor;
+    float padding1;
+};
+
 std::vector<Vec3> createIcosahedronVertices();
 
 std::vector<unsigned int> createIcosahedronFaces();
@@ -16,18 +116,55 @@ std::vector<unsigned int> createIcosahedronFaces();
 // Function to subdivide a triangle
 void subdivide(std::vector<Vec3>& vertices, const Vec3& v1, const Vec3& v2, const Vec3& v3, int depth);
 
+// Iterative subdivision of a triangle buffer, writing in place with no reallocation
+void subdivideInPlace(Vec3* triangles, size_t triangleCount, int depth);
+
 std::vector<Vec3> createIcosphere(int subdivisions);
 
+// Same output as createIcosphere(), with faces subdivided concurrently on the pool
+std::vector<Vec3> createIcosphereParallel(int subdivisions, ThreadPool& pool);
+
+// Indexed icosphere: each edge midpoint is computed once and shared by both adjacent faces
+IndexedMesh createIndexedIcosphere(int subdivisions, NormalMode normalMode = NORMALS_OMIT);
+
 GLuint createVBO(const std::vector<Vec3>& vertices);
 
-GLuint createVAO(GLuint vbo);
+GLuint createVBO(const Vec3* vertices, size_t count);
+
+GLuint createVBO(const std::vector<PackedVertex>& vertices);
+
+GLuint createVBO(const std::vector<OctahedralVertex>& vertices);
+
+GLuint createVBO(const std::vector<FloatNormalVertex>& vertices);
+
+GLuint createVAO(GLuint vbo, VertexFormat format = VERTEX_FORMAT_FLOAT);
 
 GLuint createEBO(const std::vector<unsigned int>& indices);
 
+GLuint createEBO(const unsigned int* indices, size_t count);
+
 GLuint createNormalsVBO(const std::vector<glm::vec3>& normals);
 
-void bindNormalsToVAO(GLuint vaoID, GLuint normalsVBO, GLuint normalAttributeIndex);
+GLuint createNormalsVBO(const glm::vec3* normals, size_t count);
+
+void bindNormalsToVAO(GLuint vaoID, GLuint normalsVBO, GLuint normalAttributeIndex, VertexFormat format = VERTEX_FORMAT_FLOAT);
+
+// Streamed instance data; usage is a glBufferData hint
+GLuint createInstanceVBO(const SphereInstance* instances, size_t count, GLenum usage = GL_STREAM_DRAW);
+
+// Points two consecutive attributes (position/radius, color) at the instances starting at firstInstance
+void bindInstancesToVAO(GLuint vaoID, GLuint instanceVBO, GLuint firstAttributeIndex, size_t firstInstance = 0);
+
 GLuint createShader(GLenum type, const GLchar* source);
 
 GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader);
+
+// GL 4.3; callers check GLEW_VERSION_4_3 first
+GLuint createComputeProgram(GLuint computeShader);
+
+// Static uniform buffer; per-frame blocks go through a StreamBuffer instead
+GLuint createUniformBuffer(const void* data, size_t bytes);
+
+// GL 3.3 has no layout(binding = n), so blocks are attached to their binding points after linking
+void bindUniformBlock(GLuint program, const char* blockName, GLuint bindingPoint);
 #endif // GRAPHICS_H
\ No newline at end of file
@@ -1,8 +1,15 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <string>
 #include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
 #include <cmath>
+#include <algorithm>
+#include <memory>
+#include <cassert>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp> // for glm::vec3
 #include <glm/gtc/matrix_transform.hpp>
@@ -10,6 +17,20 @@
 #include "Camera.hpp"
 #include "Object.hpp"
 #include "graphics.hpp"
+#include "GLState.hpp"
+#include "ThreadPool.hpp"
+#include "VectorBatch.hpp"
+#include "MeshCache.hpp"
+#include "IcosphereTables.hpp"
+#include "MeshOptimizer.hpp"
+#include "SphereGenerators.hpp"
+#include "Benchmarks.hpp"
+#include "AdaptiveSphere.hpp"
+#include "InstancedSpheres.hpp"
+#include "StreamBuffer.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+#include "Occlusion.hpp"
 
 const GLuint WIDTH = 800, HEIGHT = 600;
 
@@ -26,6 +47,14 @@ float lastFrame = 0.0f;
 const int KEY_COUNT = 1024;
 bool keys[KEY_COUNT] = {false}; // Global array
 
+bool adaptiveMode = false; // Toggled with T: draw a view-dependent sphere instead of the fixed one
+bool showSphereField = true; // Toggled with F: the instanced field of small spheres
+bool impostorsOnly = false; // Toggled with I: every field sphere as a ray-cast impostor, not just the tiny ones
+bool pickRequested = false; // Set with P: highlight the field sphere under the crosshair
+bool occlusionCulling = false; // Toggled with O: two-pass occlusion culling of the sphere field
+bool quaternionCamera = false; // Toggled with Q: turn the camera by quaternion instead of rebuilding it from yaw and pitch
+bool smoothCamera = false; // Toggled with M: ease camera turns and movement in
+
 // Define a simple 3D vector class
 
 
@@ -40,33 +69,12 @@ Vec3 Vec3::operator+(const Vec3& other) const {
 }
 
 std::vector<Vec3> createIcosahedronVertices() {
-    const float t = (1.0f + sqrt(5.0f)) / 2.0f; // Golden ratio
-
-    std::vector<Vec3> vertices = {
-        {-1,  t,  0}, { 1,  t,  0}, {-1, -t,  0}, { 1, -t,  0},
-        { 0, -1,  t}, { 0,  1,  t}, { 0, -1, -t}, { 0,  1, -t},
-        { t,  0, -1}, { t,  0,  1}, {-t,  0, -1}, {-t,  0,  1}
-    };
-
-    // Normalize each vertex to place it on the sphere
-    for (auto& v : vertices) {
-        v = v.normalize();
-    }
-
-    return vertices;
+    // Normalized at compile time, see IcosphereTables.hpp
+    return std::vector<Vec3>(ICOSAHEDRON_VERTICES.begin(), ICOSAHEDRON_VERTICES.end());
 }
 
 std::vector<unsigned int> createIcosahedronFaces() {
-    return {
-        // 5 faces around point 0
-        0, 11, 5,  0, 5, 1,  0, 1, 7,  0, 7, 10,  0, 10, 11,
-        // Adjacent faces 
-        1, 5, 9,  5, 11, 4,  11, 10, 2,  10, 7, 6,  7, 1, 8,
-        // 5 faces around 3
-        3, 9, 4,  3, 4, 2,  3, 2, 6,  3, 6, 8,  3, 8, 9,
-        // Adjacent faces
-        4, 9, 5,  2, 4, 11,  6, 2, 10,  8, 6, 7,  9, 8, 1
-    };
+    return std::vector<unsigned int>(ICOSAHEDRON_FACES.begin(), ICOSAHEDRON_FACES.end());
 }
 
 // Function to subdivide a triangle
@@ -88,75 +96,402 @@ void subdivide(std::vector<Vec3>& vertices, const Vec3& v1, const Vec3& v2, cons
     subdivide(vertices, mid1, mid2, mid3, depth - 1);
 }
 
+// Subdivides the first `triangleCount` triangles of `triangles` in place, one level at a time.
+// The buffer must already hold room for triangleCount * 4^depth triangles.
+void subdivideInPlace(Vec3* triangles, size_t triangleCount, int depth) {
+    for (int level = 0; level < depth; level++) {
+        // Walk backwards: triangle i expands into slots 4i..4i+3, which only
+        // overlap triangles that have already been expanded this level
+        for (size_t i = triangleCount; i-- > 0;) {
+            Vec3 v1 = triangles[3 * i];
+            Vec3 v2 = triangles[3 * i + 1];
+            Vec3 v3 = triangles[3 * i + 2];
+
+            Vec3 mid1 = (v1 + v2).normalize();
+            Vec3 mid2 = (v2 + v3).normalize();
+            Vec3 mid3 = (v3 + v1).normalize();
+
+            // Same child order as subdivide(), so the output matches the recursive version exactly
+            Vec3* out = triangles + 12 * i;
+            out[0] = v1;   out[1] = mid1;  out[2] = mid3;
+            out[3] = v2;   out[4] = mid2;  out[5] = mid1;
+            out[6] = v3;   out[7] = mid3;  out[8] = mid2;
+            out[9] = mid1; out[10] = mid2; out[11] = mid3;
+        }
+
+        triangleCount *= 4;
+    }
+}
+
 std::vector<Vec3> createIcosphere(int subdivisions) {
+    assert(subdivisions >= 0);
+    if (subdivisions < 0) {
+        return std::vector<Vec3>();
+    }
+    std::vector<Vec3> vertices = createIcosahedronVertices();
+    std::vector<unsigned int> faces = createIcosahedronFaces();
+
+    // Exact output size is known up front: 20 * 4^n triangles
+    size_t baseTriangles = faces.size() / 3;
+    std::vector<Vec3> subdividedVertices(3 * (baseTriangles << (2 * subdivisions)), Vec3(0.0f, 0.0f, 0.0f));
+
+    for (size_t i = 0; i < faces.size(); i++) {
+        subdividedVertices[i] = vertices[faces[i]];
+    }
+
+    // Subdivide all faces together, level by level
+    subdivideInPlace(subdividedVertices.data(), baseTriangles, subdivisions);
+
+    return subdividedVertices;
+}
+
+std::vector<Vec3> createIcosphereParallel(int subdivisions, ThreadPool& pool) {
+    assert(subdivisions >= 0);
+    if (subdivisions < 0) {
+        return std::vector<Vec3>();
+    }
     std::vector<Vec3> vertices = createIcosahedronVertices();
     std::vector<unsigned int> faces = createIcosahedronFaces();
 
-    std::vector<Vec3> subdividedVertices;
+    size_t baseTriangles = faces.size() / 3;
+    std::vector<Vec3> subdividedVertices(3 * (baseTriangles << (2 * subdivisions)), Vec3(0.0f, 0.0f, 0.0f));
 
-    // Subdivide each face
-    for (int i = 0; i < faces.size(); i += 3) {
-        subdivide(subdividedVertices, vertices[faces[i]], vertices[faces[i + 1]], vertices[faces[i + 2]], subdivisions);
+    for (size_t i = 0; i < faces.size(); i++) {
+        subdividedVertices[i] = vertices[faces[i]];
     }
 
+    // Split serially until there are enough independent sub-faces to keep every thread busy
+    int splitLevels = 0;
+    while (splitLevels < subdivisions && (baseTriangles << (2 * splitLevels)) < 4 * pool.size()) {
+        splitLevels++;
+    }
+    subdivideInPlace(subdividedVertices.data(), baseTriangles, splitLevels);
+
+    // Spread the sub-faces out to the start of their final, disjoint output ranges.
+    // Going backwards only ever overwrites slots that have already been moved.
+    size_t taskCount = baseTriangles << (2 * splitLevels);
+    int remainingLevels = subdivisions - splitLevels;
+    size_t rangeTriangles = size_t(1) << (2 * remainingLevels);
+
+    for (size_t task = taskCount; task-- > 1;) {
+        std::copy(&subdividedVertices[3 * task], &subdividedVertices[3 * task] + 3, &subdividedVertices[3 * task * rangeTriangles]);
+    }
+
+    // Each task owns its range, so no locking is needed
+    Vec3* triangles = subdividedVertices.data();
+    pool.parallelFor(taskCount, [=](size_t task) {
+        subdivideInPlace(triangles + 3 * task * rangeTriangles, 1, remainingLevels);
+    });
+
     return subdividedVertices;
 }
 
+// Returns the index of the midpoint of edge (a, b), computing it only the first time the edge is seen.
+// The new vertex is left unnormalized; createIndexedIcosphere() normalizes each level's midpoints in one batch.
+unsigned int getMidpoint(std::vector<Vec3>& vertices, std::unordered_map<uint64_t, unsigned int>& midpointCache, unsigned int a, unsigned int b) {
+    // Order the endpoints so both triangles sharing the edge find the same entry
+    uint64_t key = a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+
+    auto it = midpointCache.find(key);
+    if (it != midpointCache.end()) {
+        return it->second;
+    }
+
+    unsigned int index = vertices.size();
+    vertices.push_back(vertices[a] + vertices[b]);
+    midpointCache.emplace(key, index);
+
+    return index;
+}
+
+IndexedMesh createIndexedIcosphere(int subdivisions, NormalMode normalMode) {
+    IndexedMesh mesh;
+    assert(subdivisions >= 0);
+    if (subdivisions < 0) {
+        return mesh;
+    }
+
+    // Each level splits every edge once and every face into four:
+    // V = 10 * 4^n + 2 unique vertices, 20 * 4^n faces
+    mesh.vertices.reserve(icosphereVertexCount(subdivisions));
+
+    // Start from the deepest compile-time level; shallow spheres need no work at all
+    int baseLevel = std::min(subdivisions, ICOSPHERE_TABLE_MAX_LEVEL);
+    MeshView base = icosphereTableView(baseLevel);
+    mesh.vertices.assign(base.vertices, base.vertices + base.vertexCount);
+    mesh.indices.assign(base.indices, base.indices + base.indexCount);
+
+    std::unordered_map<uint64_t, unsigned int> midpointCache;
+    std::vector<unsigned int> subdividedIndices;
+
+    for (int level = baseLevel; level < subdivisions; level++) {
+        size_t faceCount = mesh.indices.size() / 3;
+
+        // Midpoints are only shared within a level, so the cache never holds more than this level's edges
+        midpointCache.clear();
+        midpointCache.reserve(faceCount * 3 / 2);
+        subdividedIndices.clear();
+        subdividedIndices.reserve(faceCount * 12);
+        size_t levelStart = mesh.vertices.size();
+
+        for (size_t i = 0; i < mesh.indices.size(); i += 3) {
+            unsigned int v1 = mesh.indices[i];
+            unsigned int v2 = mesh.indices[i + 1];
+            unsigned int v3 = mesh.indices[i + 2];
+
+            unsigned int mid1 = getMidpoint(mesh.vertices, midpointCache, v1, v2);
+            unsigned int mid2 = getMidpoint(mesh.vertices, midpointCache, v2, v3);
+            unsigned int mid3 = getMidpoint(mesh.vertices, midpointCache, v3, v1);
+
+            // Same child order and winding as subdivide()
+            subdividedIndices.insert(subdividedIndices.end(), {
+                v1, mid1, mid3,
+                v2, mid2, mid1,
+                v3, mid3, mid2,
+                mid1, mid2, mid3
+            });
+        }
+
+        // The next level reads these midpoints, so they must be on the sphere before it starts
+        normalizeBatch(&mesh.vertices[levelStart], mesh.vertices.size() - levelStart);
+
+        mesh.indices.swap(subdividedIndices);
+    }
+
+    // Positions are already unit length, so they are the normals as-is
+    if (normalMode == NORMALS_EMIT) {
+        mesh.normals = normalsFromPositions(mesh.vertices);
+    }
+
+    return mesh;
+}
+
+std::vector<glm::vec3> normalsFromPositions(const std::vector<Vec3>& positions) {
+    std::vector<glm::vec3> normals(positions.size());
+    for (size_t i = 0; i < positions.size(); i++)
+        normals[i] = glm::vec3(positions[i].x, positions[i].y, positions[i].z);
+    return normals;
+}
+
+MeshView makeMeshView(const std::vector<Vec3>& vertices, const std::vector<unsigned int>& indices, const std::vector<glm::vec3>& normals) {
+    MeshView view;
+    view.vertices = vertices.data();
+    view.vertexCount = vertices.size();
+    view.normals = normals.empty() ? nullptr : normals.data();
+    view.indices = indices.empty() ? nullptr : indices.data();
+    view.indexCount = indices.size();
+
+    return view;
+}
+
+MeshView makeMeshView(const IndexedMesh& mesh) {
+    return makeMeshView(mesh.vertices, mesh.indices, mesh.normals);
+}
+
 GLuint createVBO(const std::vector<Vec3>& vertices) {
+    return createVBO(vertices.data(), vertices.size());
+}
+
+GLuint createVBO(const Vec3* vertices, size_t count) {
     GLuint vbo;
     glGenBuffers(1, &vbo); // Generate a buffer ID
-    glBindBuffer(GL_ARRAY_BUFFER, vbo); // Bind the buffer (VBO)
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vec3), &vertices[0], GL_STATIC_DRAW); // Upload vertex data
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo); // Bind the buffer (VBO)
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vec3), vertices, GL_STATIC_DRAW); // Upload vertex data
 
     return vbo;
 }
 
-GLuint createVAO(GLuint vbo) {
+size_t vertexFormatStride(VertexFormat format) {
+    switch (format) {
+    case VERTEX_FORMAT_PACKED: return sizeof(PackedVertex);
+    case VERTEX_FORMAT_OCTAHEDRAL: return sizeof(OctahedralVertex);
+    case VERTEX_FORMAT_FLOAT_NORMAL: return sizeof(FloatNormalVertex);
+    default: return sizeof(Vec3);
+    }
+}
+
+int16_t packSnorm16(float value) {
+    return int16_t(std::round(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+}
+
+void octahedralEncode(const Vec3& normal, int16_t encoded[2]) {
+    // Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the diagonals
+    float invL1 = 1.0f / (std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z));
+    float u = normal.x * invL1;
+    float v = normal.y * invL1;
+
+    if (normal.z < 0.0f) {
+        float foldedU = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float foldedV = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    encoded[0] = packSnorm16(u);
+    encoded[1] = packSnorm16(v);
+}
+
+std::vector<PackedVertex> packVertices(const MeshView& mesh) {
+    std::vector<PackedVertex> packed(mesh.vertexCount);
+
+    for (size_t i = 0; i < mesh.vertexCount; i++) {
+        const Vec3& position = mesh.vertices[i];
+        Vec3 normal = mesh.normals != nullptr ? Vec3(mesh.normals[i].x, mesh.normals[i].y, mesh.normals[i].z) : position;
+
+        packed[i].position[0] = packSnorm16(position.x);
+        packed[i].position[1] = packSnorm16(position.y);
+        packed[i].position[2] = packSnorm16(position.z);
+        packed[i].position[3] = 0;
+        octahedralEncode(normal, packed[i].normal);
+    }
+
+    return packed;
+}
+
+std::vector<OctahedralVertex> packOctahedralVertices(const MeshView& mesh) {
+    std::vector<OctahedralVertex> packed(mesh.vertexCount);
+
+    for (size_t i = 0; i < mesh.vertexCount; i++) {
+        Vec3 normal = mesh.normals != nullptr ? Vec3(mesh.normals[i].x, mesh.normals[i].y, mesh.normals[i].z) : mesh.vertices[i];
+        octahedralEncode(normal, packed[i].normal);
+    }
+
+    return packed;
+}
+
+std::vector<FloatNormalVertex> interleaveVertices(const MeshView& mesh) {
+    std::vector<FloatNormalVertex> interleaved(mesh.vertexCount);
+
+    for (size_t i = 0; i < mesh.vertexCount; i++) {
+        interleaved[i].position = mesh.vertices[i];
+        interleaved[i].normal = mesh.normals != nullptr ? mesh.normals[i] : glm::vec3(mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z);
+    }
+
+    return interleaved;
+}
+
+GLuint createVBO(const std::vector<PackedVertex>& vertices) {
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PackedVertex), vertices.data(), GL_STATIC_DRAW);
+
+    return vbo;
+}
+
+GLuint createVBO(const std::vector<OctahedralVertex>& vertices) {
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(OctahedralVertex), vertices.data(), GL_STATIC_DRAW);
+
+    return vbo;
+}
+
+GLuint createVBO(const std::vector<FloatNormalVertex>& vertices) {
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(FloatNormalVertex), vertices.data(), GL_STATIC_DRAW);
+
+    return vbo;
+}
+
+GLuint createVAO(GLuint vbo, VertexFormat format) {
     GLuint vao;
     glGenVertexArrays(1, &vao); // Generate a VAO ID
-    glBindVertexArray(vao); // Bind the VAO
-
-    glBindBuffer(GL_ARRAY_BUFFER, vbo); // Bind the VBO
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0); // Set vertex attributes
-    glEnableVertexAttribArray(0); // Enable vertex attribute array
+    glState().bindVertexArray(vao); // Bind the VAO
+
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo); // Bind the VBO
+    if (format == VERTEX_FORMAT_FLOAT) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vec3), (void*)0); // Set vertex attributes
+        glEnableVertexAttribArray(0); // Enable vertex attribute array
+    } else if (format == VERTEX_FORMAT_PACKED) {
+        // Normalized shorts arrive in the shader as floats in [-1, 1]
+        glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glEnableVertexAttribArray(0);
+    } else if (format == VERTEX_FORMAT_FLOAT_NORMAL) {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(FloatNormalVertex), (void*)offsetof(FloatNormalVertex, position));
+        glEnableVertexAttribArray(0);
+    }
+    // VERTEX_FORMAT_OCTAHEDRAL has no position attribute; the shader decodes it from the normal
 
     return vao;
 }
 
 GLuint createEBO(const std::vector<unsigned int>& indices) {
+    return createEBO(indices.data(), indices.size());
+}
+
+GLuint createEBO(const unsigned int* indices, size_t count) {
     GLuint ebo;
     glGenBuffers(1, &ebo); // Generate buffer ID
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo); // Bind the buffer
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW); // Upload index data
+    glState().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo); // Bind the buffer
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, count * sizeof(unsigned int), indices, GL_STATIC_DRAW); // Upload index data
 
     return ebo;
 }
 
 GLuint createNormalsVBO(const std::vector<glm::vec3>& normals) {
+    return createNormalsVBO(normals.data(), normals.size());
+}
+
+GLuint createNormalsVBO(const glm::vec3* normals, size_t count) {
     GLuint vboID;
     glGenBuffers(1, &vboID); // Generate VBO
-    glBindBuffer(GL_ARRAY_BUFFER, vboID); // Bind the VBO
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW); // Upload normals data
+    glState().bindBuffer(GL_ARRAY_BUFFER, vboID); // Bind the VBO
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec3), normals, GL_STATIC_DRAW); // Upload normals data
 
     // Unbind the VBO
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glState().bindBuffer(GL_ARRAY_BUFFER, 0);
 
     return vboID; // Return the VBO ID
 }
 
-void bindNormalsToVAO(GLuint vaoID, GLuint normalsVBO, GLuint normalAttributeIndex) {
-    glBindVertexArray(vaoID); // Bind the VAO
+void bindNormalsToVAO(GLuint vaoID, GLuint normalsVBO, GLuint normalAttributeIndex, VertexFormat format) {
+    glState().bindVertexArray(vaoID); // Bind the VAO
 
     // Bind the normals VBO
-    glBindBuffer(GL_ARRAY_BUFFER, normalsVBO);
+    glState().bindBuffer(GL_ARRAY_BUFFER, normalsVBO);
 
     // Enable the vertex attribute array for normals
     glEnableVertexAttribArray(normalAttributeIndex);
 
     // Specify how the data is structured in the VBO
-    glVertexAttribPointer(normalAttributeIndex, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    if (format == VERTEX_FORMAT_FLOAT)
+        glVertexAttribPointer(normalAttributeIndex, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    else if (format == VERTEX_FORMAT_PACKED)
+        glVertexAttribPointer(normalAttributeIndex, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+    else if (format == VERTEX_FORMAT_OCTAHEDRAL)
+        glVertexAttribPointer(normalAttributeIndex, 2, GL_SHORT, GL_TRUE, sizeof(OctahedralVertex), (void*)0);
+    else
+        glVertexAttribPointer(normalAttributeIndex, 3, GL_FLOAT, GL_FALSE, sizeof(FloatNormalVertex), (void*)offsetof(FloatNormalVertex, normal));
+
+    glState().bindVertexArray(0); // Unbind the VAO
+}
 
-    glBindVertexArray(0); // Unbind the VAO
+GLuint createInstanceVBO(const SphereInstance* instances, size_t count, GLenum usage) {
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glState().bindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, count * sizeof(SphereInstance), instances, usage);
+
+    return vbo;
+}
+
+void bindInstancesToVAO(GLuint vaoID, GLuint instanceVBO, GLuint firstAttributeIndex, size_t firstInstance) {
+    glState().bindVertexArray(vaoID);
+    glState().bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+
+    // Without base-instance draws (GL 4.2) a sub-range is selected by offsetting the pointers
+    size_t base = firstInstance * sizeof(SphereInstance);
+    glEnableVertexAttribArray(firstAttributeIndex);
+    glVertexAttribPointer(firstAttributeIndex, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void*)(base + offsetof(SphereInstance, positionRadius)));
+    glVertexAttribDivisor(firstAttributeIndex, 1); // Advance once per instance instead of once per vertex
+
+    glEnableVertexAttribArray(firstAttributeIndex + 1);
+    glVertexAttribPointer(firstAttributeIndex + 1, 4, GL_FLOAT, GL_FALSE, sizeof(SphereInstance), (void*)(base + offsetof(SphereInstance, color)));
+    glVertexAttribDivisor(firstAttributeIndex + 1, 1);
 }
 
 GLuint createShader(GLenum type, const GLchar* source) {
@@ -197,6 +532,41 @@ GLuint createShaderProgram(GLuint vertexShader, GLuint fragmentShader) {
     return shaderProgram;
 }
 
+GLuint createComputeProgram(GLuint computeShader) {
+    GLuint program = glCreateProgram();
+    glAttachShader(program, computeShader);
+    glLinkProgram(program);
+
+    GLint success;
+    GLchar infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, nullptr, infoLog);
+        std::cerr << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    }
+
+    glDeleteShader(computeShader);
+
+    return program;
+}
+
+GLuint createUniformBuffer(const void* data, size_t bytes) {
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glState().bindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferData(GL_UNIFORM_BUFFER, bytes, data, GL_STATIC_DRAW);
+    return ubo;
+}
+
+void bindUniformBlock(GLuint program, const char* blockName, GLuint bindingPoint) {
+    GLuint blockIndex = glGetUniformBlockIndex(program, blockName);
+    if (blockIndex == GL_INVALID_INDEX) {
+        std::cerr << "Unable to find uniform block " << blockName << " in the shader program" << std::endl;
+        return;
+    }
+    glUniformBlockBinding(program, blockIndex, bindingPoint);
+}
+
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode) {
     if (key >= 0 && key < KEY_COUNT) {
         if (action == GLFW_PRESS)
@@ -204,6 +574,21 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         else if (action == GLFW_RELEASE)
             keys[key] = false;
     }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+        adaptiveMode = !adaptiveMode;
+    if (key == GLFW_KEY_F && action == GLFW_PRESS)
+        showSphereField = !showSphereField;
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        impostorsOnly = !impostorsOnly;
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        pickRequested = true;
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+        occlusionCulling = !occlusionCulling;
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS)
+        quaternionCamera = !quaternionCamera;
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+        smoothCamera = !smoothCamera;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
@@ -219,7 +604,8 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     lastX = xpos;
     lastY = ypos;
 
-    camera.ProcessMouseMovement(xoffset, yoffset);
+    // Applied by the camera's Update() once per frame, however many events arrive
+    camera.QueueMouseMovement(xoffset, yoffset);
 }
 
 
@@ -272,7 +658,18 @@ GLFWwindow* initWindow() {
 }
 
 
-int main() {
+int main(int argc, char** argv) {
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--bench-spheres") {
+            runSphereBenchmark();
+            return 0;
+        }
+        if (std::string(argv[i]) == "--bench-bvh") {
+            runBvhBenchmark();
+            return 0;
+        }
+    }
+
     GLFWwindow* window = initWindow();
     if (window == nullptr) {
         return -1;
@@ -285,143 +682,371 @@ int main() {
 
     std::fill_n(keys, KEY_COUNT, false);
 
-    // Create icosphere vertices
-    std::vector<Vec3> icosphereVertices = createIcosphere(5);
-    std::vector<glm::vec3> icosphereNormals;
-
-    for (const auto& vertex : icosphereVertices) {
-        // Assuming Vec3 has x, y, z components accessible
-        glm::vec3 glmVertex(vertex.x, vertex.y, vertex.z);
-
-        glm::vec3 normal = glm::normalize(glmVertex);
-        icosphereNormals.push_back(normal);
-    }
-
-    RenderableObject Sphere(icosphereVertices, icosphereNormals);
+    // Map the icosphere levels from the mesh cache (generating them on a miss); normals are rebuilt from positions in the vertex shader
+    auto loadIcosphere = [](CachedMesh& mesh, const MeshCacheKey& key) {
+        if (!mesh.load(key)) {
+            if (mesh.isMapped())
+                std::cout << "Generated icosphere and wrote " << meshCachePath("mesh_cache", key) << std::endl;
+            else
+                std::cerr << "Unable to write the mesh cache " << meshCachePath("mesh_cache", key) << "; using the generated icosphere" << std::endl;
+        }
+    };
+    CachedMesh icosphere;
+    MeshCacheKey icosphereKey = { 5, MESH_LAYOUT_POSITIONS, true };
+    loadIcosphere(icosphere, icosphereKey);
+
+    VertexCacheStats cacheStats = analyzeVertexCache(icosphere.view());
+    std::cout << "Icosphere: " << icosphere.view().indexCount / 3 << " triangles, ACMR " << cacheStats.acmr
+              << ", ATVR " << cacheStats.atvr << " (16-entry FIFO)" << std::endl;
+
+    // LOD chain from the cached levels 5 and 4 down to the 20-triangle icosahedron, all in one buffer
+    CachedMesh icosphereLevel4;
+    MeshCacheKey level4Key = { 4, MESH_LAYOUT_POSITIONS, true };
+    loadIcosphere(icosphereLevel4, level4Key);
+    std::vector<MeshView> sphereLods = { icosphere.view(), icosphereLevel4.view() };
+    for (int level = ICOSPHERE_TABLE_MAX_LEVEL; level >= 0; level--)
+        sphereLods.push_back(icosphereTableView(level));
+
+    // 4 bytes per vertex: the unit sphere's positions are decoded from octahedral normals.
+    // Static meshes share the pool's buffers and VAO, so drawing another one needs no rebinding
+    MeshPool meshPool(VERTEX_FORMAT_OCTAHEDRAL);
+    RenderableObject Sphere(meshPool, sphereLods);
+
+    // Rebuilt while adaptive mode is on once the camera has moved enough to change its error; re-uploads into
+    // its own buffers since the pool only grows
+    std::unique_ptr<RenderableObject> adaptiveSphere;
+    glm::vec3 adaptiveCameraPosition(0.0f);
+    float adaptiveZoom = 0.0f;
+
+    // 100k small spheres sharing the sphere's LOD chain: one instanced draw per level instead of one draw per sphere
+    // Per-frame instance data goes through a ring so rewriting it never waits on the GPU
+    StreamBuffer instanceStream(GL_ARRAY_BUFFER, 100000 * sizeof(SphereInstance));
+    InstancedSphereRenderer sphereField(Sphere, instanceStream);
+    sphereField.setInstances(createSphereField(100000, 50.0f));
+    std::cout << "Sphere field: " << (sphereField.getBatch() != nullptr && sphereField.getBatch()->usesMultiDraw() ? "glMultiDrawElementsIndirect" : "one draw per level") << std::endl;
+    // Below a few pixels even the 20-triangle level is wasted; a ray-cast quad is exact at 2 triangles
+    const float impostorRadiusPixels = 3.0f;
+    SphereImpostorRenderer impostors;
+    // Off until O is pressed: last frame's visible spheres first, then the rest tested against the depth they leave
+    OcclusionCuller occlusion;
+    bool fieldOcclusionCulling = false;
+    std::cout << "Occlusion culling: " << (occlusion.usesHiZ() ? "depth pyramid and compute" : "occlusion queries and conditional rendering") << std::endl;
 
     
     //shaders
-    const char* vertexShaderSource = R"glsl(
-    #version 330 core
+    // Per-frame camera state, shared by every program through UNIFORM_BINDING_CAMERA; mirrors CameraBlock
+    const char* cameraBlockSource = R"glsl(
+    layout (std140) uniform Camera {
+        mat4 view;
+        mat4 projection;
+        mat4 viewProjection;
+        vec3 viewPos; // Position of the camera
+    };
+)glsl";
+    std::string vertexShaderSource = std::string("#version 330 core\n") + cameraBlockSource + R"glsl(
     layout (location = 0) in vec3 aPos;
     layout (location = 1) in vec3 aNormal; // Normal vector
+    layout (location = 2) in vec4 aInstancePositionRadius; // Per instance: centre in xyz, radius in w
+    layout (location = 3) in vec4 aInstanceColor; // Per instance
 
     uniform mat4 model;
-    uniform mat4 view;
-    uniform mat4 projection;
+    uniform bool normalFromPosition; // Unit sphere without a normals VBO: the normal is the position
+    uniform int vertexFormat; // VertexFormat: 0 float, 1 snorm16 + octahedral normal, 2 octahedral normal only, 3 interleaved float position + normal
+    uniform bool instanced; // Place the unit mesh with the instance attributes instead of model
+    uniform vec3 objectColor; // Color of the object when not instanced
 
     out vec3 Normal; // Normal to pass to fragment shader
     out vec3 FragPos; // Fragment position
+    out vec3 Color; // Object or instance color
+
+    // Inverse of octahedralEncode() in main.cpp
+    vec3 octahedralDecode(vec2 e) {
+        vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+        float t = max(-n.z, 0.0);
+        n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+        return normalize(n);
+    }
 
     void main() {
-        FragPos = vec3(model * vec4(aPos, 1.0));
-        Normal = mat3(transpose(inverse(model))) * aNormal;
-
-        gl_Position = projection * view * model * vec4(aPos, 1.0);
+        vec3 position = aPos;
+        vec3 objectNormal = normalFromPosition ? aPos : aNormal;
+
+        if (vertexFormat == 1 || vertexFormat == 2)
+            objectNormal = octahedralDecode(aNormal.xy);
+        if (vertexFormat == 2)
+            position = objectNormal; // Unit sphere: the position is the normal
+
+        if (instanced) {
+            // Translation and uniform scale only, so the normal needs no transform
+            FragPos = aInstancePositionRadius.xyz + aInstancePositionRadius.w * position;
+            Normal = objectNormal;
+            Color = aInstanceColor.rgb;
+        } else {
+            FragPos = vec3(model * vec4(position, 1.0));
+            Normal = mat3(transpose(inverse(model))) * objectNormal;
+            Color = objectColor;
+        }
+
+        gl_Position = viewProjection * vec4(FragPos, 1.0);
     }
 )glsl";
-    const char* fragmentShaderSource = R"glsl(
-    #version 330 core
-    out vec4 FragColor;
-
-    in vec3 Normal; // Normal vector
-    in vec3 FragPos; // Fragment position
-
-    // Light properties
-    uniform vec3 lightPos; // Position of the light source
-    uniform vec3 viewPos; // Position of the camera
-    uniform vec3 lightColor; // Color of the light
-    uniform vec3 objectColor; // Color of the object
+    // Phong lighting shared by the mesh and impostor fragment shaders, pasted in after the camera block
+    const char* phongLightingSource = R"glsl(
+    // Light properties, set once through UNIFORM_BINDING_LIGHT; mirrors LightBlock
+    layout (std140) uniform Light {
+        vec3 lightPos; // Position of the light source
+        vec3 lightColor; // Color of the light
+    };
 
-    void main() {
+    vec3 phongLighting(vec3 normal, vec3 fragPos, vec3 color) {
         // Ambient
         float ambientStrength = 0.2;
         vec3 ambient = ambientStrength * lightColor;
     
         // Diffuse 
-        vec3 norm = normalize(Normal);
-        vec3 lightDir = normalize(lightPos - FragPos);
+        vec3 norm = normalize(normal);
+        vec3 lightDir = normalize(lightPos - fragPos);
         float diff = max(dot(norm, lightDir), 0.0);
         vec3 diffuse = diff * lightColor;
 
         // Specular
         float specularStrength = 0.7;
-        vec3 viewDir = normalize(viewPos - FragPos);
+        vec3 viewDir = normalize(viewPos - fragPos);
         vec3 reflectDir = reflect(-lightDir, norm);  
         float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32);
         vec3 specular = specularStrength * spec * lightColor;  
 
-        vec3 result = (ambient + diffuse + specular) * objectColor;
+        return (ambient + diffuse + specular) * color;
+    }
+)glsl";
+    std::string fragmentShaderSource = std::string("#version 330 core\n") + cameraBlockSource + phongLightingSource + R"glsl(
+    out vec4 FragColor;
+
+    in vec3 Normal; // Normal vector
+    in vec3 FragPos; // Fragment position
+    in vec3 Color; // Object or instance color
+
+    void main() {
+        vec3 result = phongLighting(Normal, FragPos, Color);
         vec3 visualizedNormal = normalize(Normal) * 0.5 + 0.5;
         FragColor = vec4(result, 1.0);
     }
 
 )glsl";
 
+    // Impostors: a camera-facing quad per SphereInstance, ray-cast against the exact sphere
+    std::string impostorVertexShaderSource = std::string("#version 330 core\n") + cameraBlockSource + R"glsl(
+    layout (location = 0) in vec4 aInstancePositionRadius; // Centre in xyz, radius in w
+    layout (location = 1) in vec4 aInstanceColor;
+
+    out vec3 FragPos; // Point on the quad, in world space
+    flat out vec4 Sphere;
+    flat out vec3 Color;
 
+    const vec2 corners[4] = vec2[4](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));
 
-    GLuint vertexShader = createShader(GL_VERTEX_SHADER, vertexShaderSource);
-    GLuint fragmentShader = createShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
+    void main() {
+        vec3 center = aInstancePositionRadius.xyz;
+        float radius = aInstancePositionRadius.w;
+        Sphere = aInstancePositionRadius;
+        Color = aInstanceColor.rgb;
+
+        vec3 toCenter = center - viewPos;
+        float centerDistance = length(toCenter);
+        if (centerDistance <= radius) {
+            // Camera inside the sphere: nothing sensible to draw
+            FragPos = center;
+            gl_Position = vec4(0.0);
+            return;
+        }
+
+        vec3 forward = toCenter / centerDistance;
+        vec3 right = normalize(cross(forward, abs(forward.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0)));
+        vec3 up = cross(right, forward);
+
+        // Through the centre, facing the camera, just wide enough to cover the silhouette cone
+        float halfSize = radius * centerDistance / sqrt(centerDistance * centerDistance - radius * radius);
+        vec2 corner = corners[gl_VertexID];
+        FragPos = center + (right * corner.x + up * corner.y) * halfSize;
+
+        gl_Position = viewProjection * vec4(FragPos, 1.0);
+    }
+)glsl";
+    std::string impostorFragmentShaderSource = std::string("#version 330 core\n") + cameraBlockSource + phongLightingSource + R"glsl(
+    out vec4 FragColor;
+
+    in vec3 FragPos;
+    flat in vec4 Sphere;
+    flat in vec3 Color;
+
+    void main() {
+        vec3 rayDir = normalize(FragPos - viewPos);
+        vec3 toCamera = viewPos - Sphere.xyz;
+
+        // Distance from the centre to the ray, rather than |oc|^2 - r^2, keeps precision on small, far spheres
+        float along = dot(toCamera, rayDir);
+        vec3 closest = toCamera - along * rayDir;
+        float discriminant = Sphere.w * Sphere.w - dot(closest, closest);
+        if (discriminant < 0.0)
+            discard;
+
+        vec3 hit = viewPos + (-along - sqrt(discriminant)) * rayDir;
+        vec3 normal = (hit - Sphere.xyz) / Sphere.w;
+
+        // The quad's own depth is that of the centre plane; use the sphere's instead (default glDepthRange)
+        vec4 clip = viewProjection * vec4(hit, 1.0);
+        gl_FragDepth = 0.5 * (clip.z / clip.w) + 0.5;
+
+        FragColor = vec4(phongLighting(normal, hit, Color), 1.0);
+    }
+)glsl";
+
+
+
+    GLuint vertexShader = createShader(GL_VERTEX_SHADER, vertexShaderSource.c_str());
+    GLuint fragmentShader = createShader(GL_FRAGMENT_SHADER, fragmentShaderSource.c_str());
     GLuint shaderProgram = createShaderProgram(vertexShader, fragmentShader);
+
+    GLuint impostorVertexShader = createShader(GL_VERTEX_SHADER, impostorVertexShaderSource.c_str());
+    GLuint impostorFragmentShader = createShader(GL_FRAGMENT_SHADER, impostorFragmentShaderSource.c_str());
+    GLuint impostorProgram = createShaderProgram(impostorVertexShader, impostorFragmentShader);
     
+    // Camera and light come from uniform buffers bound at fixed points, the same for both programs
+    bindUniformBlock(shaderProgram, "Camera", UNIFORM_BINDING_CAMERA);
+    bindUniformBlock(shaderProgram, "Light", UNIFORM_BINDING_LIGHT);
+    bindUniformBlock(impostorProgram, "Camera", UNIFORM_BINDING_CAMERA);
+    bindUniformBlock(impostorProgram, "Light", UNIFORM_BINDING_LIGHT);
+
+    LightBlock light = { glm::vec3(3.0f, 0.5f, 0.0f), 0.0f, glm::vec3(1.0f, 1.0f, 1.0f), 0.0f };
+    GLuint lightUBO = createUniformBuffer(&light, sizeof(light));
+    glState().bindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING_LIGHT, lightUBO);
+    StreamBuffer uniformStream(GL_UNIFORM_BUFFER, 4096);
+
     GLint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLint projLoc = glGetUniformLocation(shaderProgram, "projection");
-    GLint lightPosLoc = glGetUniformLocation(shaderProgram, "lightPos");
-    GLint viewPosLoc = glGetUniformLocation(shaderProgram, "viewPos");
-    GLint lightColorLoc = glGetUniformLocation(shaderProgram, "lightColor");
     GLint objectColorLoc = glGetUniformLocation(shaderProgram, "objectColor");
+    GLint normalFromPositionLoc = glGetUniformLocation(shaderProgram, "normalFromPosition");
+    GLint vertexFormatLoc = glGetUniformLocation(shaderProgram, "vertexFormat");
+    GLint instancedLoc = glGetUniformLocation(shaderProgram, "instanced");
+
 
 
 
     // Check for errors
-    if (modelLoc == -1 || viewLoc == -1 || projLoc == -1) {
+    if (modelLoc == -1) {
         std::cerr << "Unable to find matrix uniforms in the shader program" << std::endl;
     }
 
-    glEnable(GL_DEPTH_TEST);
+    glState().enable(GL_DEPTH_TEST);
+    camera.SetProjection((float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
+    size_t frameCount = 0;
     // Main loop
     while (!glfwWindowShouldClose(window)) {
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        if (keys[GLFW_KEY_W])
-        camera.ProcessKeyboard(Camera::FORWARD, deltaTime);
-        if (keys[GLFW_KEY_S])
-            camera.ProcessKeyboard(Camera::BACKWARD, deltaTime);
-        if (keys[GLFW_KEY_A])
-            camera.ProcessKeyboard(Camera::LEFT, deltaTime);
-        if (keys[GLFW_KEY_D])
-            camera.ProcessKeyboard(Camera::RIGHT, deltaTime);
+        camera.SetOrientationMode(quaternionCamera ? Camera::QUATERNION : Camera::EULER);
+        camera.Smoothing = smoothCamera ? 15.0f : 0.0f;
+        camera.Update(deltaTime, keys[GLFW_KEY_W], keys[GLFW_KEY_S], keys[GLFW_KEY_A], keys[GLFW_KEY_D]);
+
+        if (adaptiveMode) {
+            AdaptiveSphereParams adaptiveParams;
+            // Projected error goes with 1 / distance to the surface, so a move of a few percent of that
+            // distance shifts it by about as much; smaller moves (an easing camera's tail) keep the mesh
+            float surfaceDistance = std::max(glm::length(camera.Position - adaptiveParams.center) - adaptiveParams.radius, 0.01f * adaptiveParams.radius);
+            bool moved = glm::length(camera.Position - adaptiveCameraPosition) > 0.05f * surfaceDistance;
+            if (adaptiveSphere == nullptr || moved || camera.Zoom != adaptiveZoom) {
+                adaptiveParams.cameraPosition = camera.Position;
+                adaptiveParams.fovDegrees = camera.Zoom;
+                adaptiveParams.viewportHeight = HEIGHT;
+                IndexedMesh adaptiveMesh = createAdaptiveIcosphere(adaptiveParams);
+                if (adaptiveSphere == nullptr)
+                    adaptiveSphere.reset(new RenderableObject(makeMeshView(adaptiveMesh)));
+                else
+                    adaptiveSphere->replaceMesh(makeMeshView(adaptiveMesh));
+                adaptiveCameraPosition = camera.Position;
+                adaptiveZoom = camera.Zoom;
+            }
+        }
+        RenderableObject& drawnSphere = adaptiveMode ? *adaptiveSphere : Sphere;
 
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(shaderProgram);
-
-        // Create transformations
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, 0.1f, 100.0f);
-        glm::mat4 model = glm::mat4(1.0f); // Start with the identity matrix
-        glm::vec3 cameraPosition = camera.Position;
-
+        glState().useProgram(shaderProgram);
+
+        // Cached by the camera, rebuilt only after it moves
+        const glm::mat4& view = camera.GetViewMatrix();
+        const glm::mat4& projection = camera.GetProjectionMatrix();
+        const glm::mat4& viewProjection = camera.GetViewProjectionMatrix();
+        const Frustum& frustum = camera.GetFrustum();
+        drawnSphere.selectLod(camera.Position, projection, HEIGHT);
+        glm::mat4 model = drawnSphere.getModelMatrix();
+
+        // One block write per frame covers both programs
+        CameraBlock cameraBlock;
+        cameraBlock.view = view;
+        cameraBlock.projection = projection;
+        cameraBlock.viewProjection = viewProjection;
+        cameraBlock.viewPos = camera.Position;
+        cameraBlock.padding = 0.0f;
+        uniformStream.writeUniformBlock(UNIFORM_BINDING_CAMERA, &cameraBlock, sizeof(cameraBlock));
 
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
         glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-
-        glUniform3f(lightPosLoc, 3.0f, 0.5f, 0.0f);
-        glUniform3f(viewPosLoc, cameraPosition.x, cameraPosition.y, cameraPosition.z);
-        glUniform3f(lightColorLoc, 1.0f, 1.0f, 1.0f);
         glUniform3f(objectColorLoc, 1.0f, 0.4f, 0.4f);
+        glUniform1i(normalFromPositionLoc, !drawnSphere.hasNormals());
+        glUniform1i(vertexFormatLoc, drawnSphere.getVertexFormat());
 
         // Render the icosphere
-        Sphere.render(shaderProgram);
+        if (drawnSphere.inFrustum(frustum))
+            drawnSphere.render(shaderProgram);
+
+        if (showSphereField && pickRequested) {
+            BvhRayHit hit = sphereField.getHierarchy().raycast(camera.Position, camera.Front);
+            if (hit.object != SphereBVH::NONE) {
+                sphereField.setInstanceColor(hit.object, glm::vec3(1.0f));
+                std::cout << "Picked sphere " << hit.object << " at distance " << hit.distance << std::endl;
+            }
+        }
+        pickRequested = false;
+
+        if (occlusionCulling != fieldOcclusionCulling) {
+            sphereField.setOcclusionCuller(occlusionCulling ? &occlusion : nullptr);
+            fieldOcclusionCulling = occlusionCulling;
+        }
+
+        if (showSphereField) {
+            glUniform1i(instancedLoc, 1);
+            glUniform1i(normalFromPositionLoc, !Sphere.hasNormals());
+            glUniform1i(vertexFormatLoc, Sphere.getVertexFormat());
+            sphereField.setImpostorRadiusPixels(impostorsOnly ? 1e30f : impostorRadiusPixels);
+            sphereField.render(frustum, camera.Position, projection, HEIGHT, 1.0f, camera.GetVersion());
+            glUniform1i(instancedLoc, 0);
+
+            glState().useProgram(impostorProgram);
+            sphereField.renderImpostors(impostors);
+
+            // Second pass: whatever was hidden last frame, if it shows past everything drawn so far
+            sphereField.cullOccluded(viewProjection, WIDTH, HEIGHT);
+            if (sphereField.getDeferredCount() > 0) {
+                glState().useProgram(shaderProgram);
+                glUniform1i(instancedLoc, 1);
+                sphereField.renderRevealed();
+                glUniform1i(instancedLoc, 0);
+                glState().useProgram(impostorProgram);
+                sphereField.renderRevealedImpostors(impostors);
+            }
+        }
+        instanceStream.endFrame();
+        uniformStream.endFrame();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+        frameCount++;
     }
 
+    std::cout << "GL state cache: " << glState().getIssuedCount() << " calls issued, " << glState().getElidedCount()
+              << " elided over " << frameCount << " frames" << std::endl;
+
     // Clean up
     glfwDestroyWindow(window);
     glfwTerminate();